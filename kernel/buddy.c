@@ -0,0 +1,183 @@
+// Buddy allocator for physically contiguous memory.
+//
+// Free memory is kept in blocks of 2^order pages,
+// 0 <= order <= MAXORDER, each aligned to its own size.
+// Allocation splits a larger block when no block of
+// the wanted order is free; freeing a block merges it
+// with its buddy (the other half of the enclosing
+// block of the next order) for as long as the buddy
+// is free as well.
+//
+// kalloc.c keeps per-CPU lists of single pages in front
+// of this allocator, so most single-page allocations
+// never take buddy.lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PAGEIDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDXPAGE(i) ((void*)(KERNBASE + (uint64)(i) * PGSIZE))
+
+#define B_FREE 0x80  // page heads a free block; low bits hold its order
+
+// A free block; lives in the block's first page.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block free[MAXORDER+1];  // circular lists, one per order
+  uint64 nfree[MAXORDER+1];       // blocks on each list
+  uchar *info;                    // B_FREE|order for free block heads, by page
+} buddy;
+
+static void
+push(int order, uint64 i)
+{
+  struct block *b = (struct block*)IDXPAGE(i);
+  struct block *h = &buddy.free[order];
+
+  b->next = h->next;
+  b->prev = h;
+  h->next->prev = b;
+  h->next = b;
+  buddy.info[i] = B_FREE | order;
+  buddy.nfree[order]++;
+}
+
+static void
+unlink(int order, uint64 i)
+{
+  struct block *b = (struct block*)IDXPAGE(i);
+
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.info[i] = 0;
+  buddy.nfree[order]--;
+}
+
+// Set up the free lists, and the table of page states,
+// which is as big as RAM calls for (see bootalloc()).
+void
+buddyinit(void)
+{
+  initlock(&buddy.lock, "buddy");
+  buddy.info = bootalloc(NPAGE);
+  for(int k = 0; k <= MAXORDER; k++){
+    buddy.free[k].next = &buddy.free[k];
+    buddy.free[k].prev = &buddy.free[k];
+  }
+}
+
+// Allocate 2^order physically contiguous pages,
+// aligned to their size. Returns 0 if no block
+// that large is free.
+void *
+buddyalloc(int order)
+{
+  int k;
+  uint64 i;
+
+  if(order < 0 || order > MAXORDER)
+    panic("buddyalloc: order");
+
+  acquire(&buddy.lock);
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.nfree[k] > 0)
+      break;
+  if(k > MAXORDER){
+    release(&buddy.lock);
+    return 0;
+  }
+  i = PAGEIDX(buddy.free[k].next);
+  unlink(k, i);
+
+  // give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    push(k, i + (1L << k));
+  }
+  release(&buddy.lock);
+
+  return IDXPAGE(i);
+}
+
+// Free a block of 2^order pages that buddyalloc() returned,
+// or part of one, coalescing it with free buddies.
+void
+buddyfree(void *pa, int order)
+{
+  uint64 i, b;
+
+  if(order < 0 || order > MAXORDER)
+    panic("buddyfree: order");
+  i = PAGEIDX(pa);
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < KERNBASE ||
+     i + (1L << order) > NPAGE || (i & ((1L << order) - 1)) != 0)
+    panic("buddyfree");
+
+  acquire(&buddy.lock);
+  if(buddy.info[i] & B_FREE)
+    panic("buddyfree: double free");
+  while(order < MAXORDER){
+    b = i ^ (1L << order);
+    if(b >= NPAGE || buddy.info[b] != (B_FREE | order))
+      break;
+    unlink(order, b);
+    if(b < i)
+      i = b;
+    order++;
+  }
+  push(order, i);
+  release(&buddy.lock);
+}
+
+// Return the number of free pages. Reads the counts
+// without the lock, so the answer may be slightly stale.
+uint64
+buddynfree(void)
+{
+  uint64 pages = 0;
+
+  for(int k = 0; k <= MAXORDER; k++)
+    pages += buddy.nfree[k] << k;
+  return pages;
+}
+
+// Report free blocks per order and a fragmentation
+// estimate: the percentage of free memory that is not
+// in the largest free block.
+int
+statsbuddy(char *buf, int sz)
+{
+  int n, k, largest;
+  uint64 pages, nfree[MAXORDER+1];
+
+  acquire(&buddy.lock);
+  for(k = 0; k <= MAXORDER; k++)
+    nfree[k] = buddy.nfree[k];
+  release(&buddy.lock);
+
+  pages = 0;
+  largest = -1;
+  for(k = 0; k <= MAXORDER; k++){
+    pages += nfree[k] << k;
+    if(nfree[k])
+      largest = k;
+  }
+
+  n = snprintf(buf, sz, "buddy: free %ld largest order %d frag %d%%\n", pages, largest,
+               pages ? (int)(100 - (100 * (1L << largest)) / pages) : 0);
+  n += snprintf(buf+n, sz-n, "buddy blocks:");
+  for(k = 0; k <= MAXORDER; k++)
+    n += snprintf(buf+n, sz-n, " %ld", nfree[k]);
+  n += snprintf(buf+n, sz-n, "\n");
+  return n;
+}
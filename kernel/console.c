@@ -80,7 +80,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -107,9 +107,13 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer,
+    // without cons.lock: the page may have to be read in.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    r = either_copyout(user_dst, dst, &cbuf, 1);
+    acquire(&cons.lock);
+    if(r == -1)
       break;
 
     dst++;
@@ -2,12 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -17,11 +19,24 @@ void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// buddy.c
+void            buddyinit(void);
+void*           buddyalloc(int);
+void            buddyfree(void*, int);
+uint64          buddynfree(void);
+int             statsbuddy(char*, int);
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dtb.c
+extern uint64   dtbpa;
+extern int      ncpu;
+extern uint64   timebase;
+void            dtbinit(void);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -44,6 +59,7 @@ void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+int             iholding(void);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -63,6 +79,16 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_zeroed(void);
+void            krefinc(void*);
+int             krefcnt(void*);
+int             kzeroidle(void);
+void*           kallocpages(int);
+void*           ktrypages(int);
+void            kfreepages(void*, int);
+uint64          kfreecount(void);
+void*           bootalloc(uint64);
+int             statskalloc(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,7 +96,12 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// main.c
+void            bootphase(char*);
+void            bootprint(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -100,16 +131,39 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             statsproc(char*, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// runq.c
+void            runqinit(void);
+void            runqput(struct proc*);
+void            runqstart(struct proc*);
+struct proc*    runqget(void);
+void            runqdone(struct proc*);
+void            runqidle(void);
+int             runqsetweight(int);
+int             runqtick(void);
+void            runqtimer(uint64);
+int             statsrunq(char*, int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             statsslab(char*, int);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -117,6 +171,7 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             cansleep(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -124,7 +179,13 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// stats.c
+void            statsinit(void);
+
 // string.c
+#ifdef RVV
+extern int      rvv;
+#endif
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
@@ -133,6 +194,16 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+void            swapon(int);
+void            kswapdwake(void);
+void*           kalloc_user(int);
+uint64          swapin(pte_t*);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+int             statsswap(char*, int);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -141,8 +212,22 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// textcache.c
+void            textinit(void);
+void*           textget(struct inode*, uint64);
+void            textput(struct inode*, uint64, void*);
+void            textinval(struct inode*);
+int             textreclaim(void);
+int             statstext(char*, int);
+
 // trap.c
 extern uint     ticks;
+extern uint64   tickcycles;
+extern int      sstc;
+uint64          clock_ns(void);
+void            tickupdate(void);
+void            tickwakeat(uint);
+void            timerarm(uint64);
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -150,14 +235,34 @@ void            usertrapret(void);
 
 // uart.c
 void            uartinit(void);
+void            uartremap(void);
 void            uartintr(void);
 void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// vma.c
+void            vmainit(void);
+struct vma*     vmalookup(struct proc*, uint64);
+void*           vmapage(struct vma*, uint64);
+int             vmaoverlap(struct proc*, uint64, uint64);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaclose(struct vma*);
+void            vmatrunc(struct proc*, uint64);
+int             vmaunmap(struct proc*, uint64, uint64);
+uint64          vmammap(struct proc*, uint64, int, int, struct inode*, uint64);
+
+// copyuser.S
+int             copyuser(char*, char*, uint64);
+int             copyinstruser(char*, char*, uint64);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmsync(struct proc*);
+void            kvmswitch(struct proc*);
+int             kvmfault(uint64, int);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -165,10 +270,17 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmsplit(pagetable_t, uint64);
+uint64          vmfault(pagetable_t, uint64, int);
+int             uvmprefault(pagetable_t, uint64, uint64, int);
+uint64          uvmsatp(struct proc*);
+int             statsvm(char*, int);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkleaf(pagetable_t, uint64, int, int*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -0,0 +1,145 @@
+// Reading the flattened device tree (DTB) that qemu
+// passes to the kernel at boot, to find out how much RAM
+// the machine has, how many CPUs, and how fast its clock
+// ticks.
+//
+// The DTB is a header, then a stream of big-endian 32-bit
+// tokens: BEGIN_NODE with the node's name, PROP with a
+// length, an offset into the strings block for the
+// property's name, and the value, END_NODE, and END.
+// Only a few things matter here:
+//
+//   /memory@80000000  reg = <base size>, each of
+//                     #address-cells and #size-cells cells
+//   /cpus             timebase-frequency, of the time CSR
+//   /cpus/cpu@N       one per hart
+//
+// dtbinit() runs before kinit(), with paging off, since
+// the DTB sits in RAM that kinit() hands out.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+struct fdt_header {
+  uint magic;
+  uint totalsize;
+  uint off_dt_struct;
+  uint off_dt_strings;
+  uint off_mem_rsvmap;
+  uint version;
+  uint last_comp_version;
+  uint boot_cpuid_phys;
+  uint size_dt_strings;
+  uint size_dt_struct;
+};
+
+uint64 dtbpa;   // physical address of the DTB; set by start()
+
+// what the kernel assumes if there is no DTB.
+uint64 phystop = KERNBASE + 128*1024*1024;
+int ncpu = NCPU;
+uint64 timebase = 10000000;
+
+static uint
+be32(void *p)
+{
+  uchar *b = p;
+
+  return ((uint)b[0] << 24) | ((uint)b[1] << 16) | ((uint)b[2] << 8) | b[3];
+}
+
+// a number n cells long, as in a reg property.
+static uint64
+becells(char *p, int n)
+{
+  uint64 x = 0;
+
+  for(int i = 0; i < n; i++)
+    x = (x << 32) | be32(p + 4*i);
+  return x;
+}
+
+static int
+prefix(char *s, char *pre)
+{
+  return strncmp(s, pre, strlen(pre)) == 0;
+}
+
+// Set phystop to the end of the memory region that the
+// kernel was loaded into, at most PHYSMAX, ncpu to the
+// number of cpu nodes, at most NCPU, and timebase to the
+// frequency of the time CSR.
+void
+dtbinit(void)
+{
+  struct fdt_header *h = (struct fdt_header*)dtbpa;
+  char *p, *strs, *name, *val;
+  int depth = 0, acells = 2, scells = 2, incpus = 0, inmem = 0, n = 0;
+  uint len, tok;
+  uint64 base, size, top = 0;
+
+  if(h == 0 || be32(&h->magic) != FDT_MAGIC)
+    return;
+  p = (char*)h + be32(&h->off_dt_struct);
+  strs = (char*)h + be32(&h->off_dt_strings);
+
+  for(;;){
+    tok = be32(p);
+    p += 4;
+    if(tok == FDT_BEGIN_NODE){
+      name = p;
+      p += (strlen(name) + 1 + 3) & ~3;
+      depth++;
+      if(depth == 2){
+        incpus = strncmp(name, "cpus", 5) == 0;
+        inmem = prefix(name, "memory");
+      } else if(depth == 3 && incpus && prefix(name, "cpu@")){
+        n++;
+      }
+    } else if(tok == FDT_END_NODE){
+      if(depth == 2)
+        incpus = inmem = 0;
+      depth--;
+    } else if(tok == FDT_PROP){
+      len = be32(p);
+      name = strs + be32(p + 4);
+      val = p + 8;
+      p += 8 + ((len + 3) & ~3);
+      if(depth == 1 && strncmp(name, "#address-cells", 15) == 0)
+        acells = be32(val);
+      else if(depth == 1 && strncmp(name, "#size-cells", 12) == 0)
+        scells = be32(val);
+      else if(depth == 2 && incpus && strncmp(name, "timebase-frequency", 19) == 0 && len == 4)
+        timebase = be32(val);
+      else if(depth == 2 && inmem && strncmp(name, "reg", 4) == 0){
+        for(uint i = 0; i + 4*(acells+scells) <= len; i += 4*(acells+scells)){
+          base = becells(val + i, acells);
+          size = becells(val + i + 4*acells, scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            top = base + size;
+        }
+      }
+    } else if(tok == FDT_NOP){
+      continue;
+    } else {
+      break; // FDT_END, or something unexpected.
+    }
+  }
+
+  if(top > PHYSMAX)
+    top = PHYSMAX;
+  if(top > KERNBASE)
+    phystop = PGROUNDDOWN(top);
+  if(n > 0)
+    ncpu = n < NCPU ? n : NCPU;
+}
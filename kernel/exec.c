@@ -3,11 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "fcntl.h"
 
 int flags2perm(int flags)
 {
@@ -19,15 +21,19 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Program segments are not read in here: each gets a VMA
+// that refers to the executable, and vmfault() reads a
+// page in from it the first time the program touches it.
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nvma = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +55,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  memset(vma, 0, sizeof(vma));
+
+  // Map program segments, to be paged in on demand.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,12 +69,21 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz > TRAPFRAME)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nvma >= NVMA)
       goto bad;
+    v = &vma[nvma++];
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->perm = flags2perm(ph.flags) | PTE_R | PTE_U;
+    v->flags = MAP_PRIVATE;
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -120,14 +137,24 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image, first writing back and
+  // unmapping the old image's mappings.
+  vmaunmap(p, 0, MAXVA);
+  memmove(p->vma, vma, sizeof(vma));
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->tlbflush = 1;  // the ASID's TLB entries are for the old image.
+  kvmsync(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
 
+  if(p->pid == 1){
+    bootphase("exec init");
+    bootprint();
+  }
+
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
@@ -137,30 +164,9 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  begin_op();
+  for(i = 0; i < nvma; i++)
+    vmaclose(&vma[i]);
+  end_op();
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
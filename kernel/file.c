@@ -13,6 +13,8 @@
 #include "stat.h"
 #include "proc.h"
 
+#define READCHUNK (16*PGSIZE)  // bytes fileread() faults in and reads at once
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -118,10 +120,32 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // a page fault on a page of another file takes that
+    // file's lock (see vmapage()), so fault the buffer in
+    // a chunk at a time before locking this one. if readi()
+    // fails anyway, a page was swapped out again; retry.
+    int i = 0, n1;
+    while(i < n){
+      n1 = n - i < READCHUNK ? n - i : READCHUNK;
+      if(uvmprefault(myproc()->pagetable, addr + i, n1, 1) < 0){
+        r = -1;
+        break;
+      }
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      if(r < 0){
+        if(killed(myproc()))
+          break;
+        continue;
+      }
+      i += r;
+      if(r < n1)
+        break;
+    }
+    if(i > 0 || r >= 0)
+      r = i;
   } else {
     panic("fileread");
   }
@@ -159,6 +183,9 @@ filewrite(struct file *f, uint64 addr, int n)
       if(n1 > max)
         n1 = max;
 
+      // as in fileread(), fault the source in before locking.
+      if(uvmprefault(myproc()->pagetable, addr + i, n1, 0) < 0)
+        break;
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
@@ -326,6 +326,16 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Does the current process hold any inode's lock?
+int
+iholding(void)
+{
+  for(int i = 0; i < NINODE; i++)
+    if(holdingsleep(&itable.inode[i].lock))
+      return 1;
+  return 0;
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
 // be recycled.
@@ -429,6 +439,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -535,6 +547,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   // block to ip->addrs[].
   iupdate(ip);
 
+  // drop cached program pages, including any the copy
+  // above faulted in from this file.
+  if(tot > 0)
+    textinval(ip);
+
   return tot;
 }
 
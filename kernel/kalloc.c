@@ -1,6 +1,26 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or with kallocpages(), 2^order contiguous pages
+// from the buddy allocator in buddy.c.
+//
+// Each CPU keeps its own list of free pages in front of
+// the buddy allocator, so that kalloc() and kfree() on
+// different CPUs don't contend for one lock. A CPU whose
+// list runs dry refills it with a batch from the buddy
+// allocator, or failing that, steals a batch from a sibling.
+//
+// Each CPU also keeps a pool of pages that are already
+// zeroed, for kalloc_zeroed(). The scheduler refills the
+// pool by calling kzeroidle() when it has nothing to run.
+//
+// Building with KMEMDEBUG=1 fills freed and newly
+// allocated pages with junk to catch dangling references.
+//
+// Every allocated page has a reference count, so that
+// copy-on-write fork can share a page between page tables.
+// kalloc() sets it to 1, krefinc() adds a reference, and
+// kfree() only frees the page when the last one goes away.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +29,20 @@
 #include "riscv.h"
 #include "defs.h"
 
+// how many pages kalloc() takes from a sibling
+// CPU's free list when its own list is empty.
+#define NSTEAL 64
+
+// a CPU's list is refilled from the buddy allocator
+// 2^KBATCHORDER pages at a time, and gives that many
+// back once it holds more than KCACHEMAX pages.
+#define KBATCHORDER 4
+#define KBATCH (1 << KBATCHORDER)
+#define KCACHEMAX (4 * KBATCH)
+
+// kzeroidle() stops zeroing once a CPU has this many zeroed pages.
+#define KZEROMAX 64
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,48 +52,208 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  struct run *zerolist; // free pages known to be all zeroes
+  uint64 nfree;   // pages on freelist
+  uint64 nzero;   // pages on zerolist
+  uint64 nzhit;   // kalloc_zeroed()s satisfied from zerolist
+  uint64 nzmiss;  // kalloc_zeroed()s that had to zero a page
+  uint64 nhit;    // kalloc()s satisfied from this CPU's own list
+  uint64 nrefill; // times this CPU refilled from the buddy allocator
+  uint64 nsteal;  // times this CPU refilled from a sibling
+  uint64 nstolen; // pages siblings took from this CPU's list
+};
+
+struct kmem kmem[NCPU];
+
+// per-page reference counts, indexed by physical page number.
+// updated with atomic instructions rather than under a lock.
+#define PA2REF(pa) (&kref[((uint64)(pa) - KERNBASE) / PGSIZE])
+static int *kref;
+
+// the end of the tables that bootalloc() carves out just
+// after the kernel; allocatable pages start here.
+static char *bootend = end;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  kref = bootalloc((PHYSTOP - KERNBASE) / PGSIZE * sizeof(int));
+  buddyinit();
+  freerange(bootend, (void*)PHYSTOP);
+}
+
+// Allocate n zeroed bytes that are never freed, for
+// tables whose size depends on the amount of RAM. Only
+// for use by kinit(), before it frees the rest of memory.
+void*
+bootalloc(uint64 n)
+{
+  char *p = (char*)(((uint64)bootend + 7) & ~7L);
+
+  bootend = p + n;
+  if((uint64)bootend > PHYSTOP)
+    panic("bootalloc");
+  memset(p, 0, n);
+  return p;
 }
 
+// Hand the pages from pa_start to pa_end to the buddy
+// allocator, in the largest aligned blocks that fit, so
+// that booting takes a call per 2^MAXORDER pages rather
+// than one per page.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 p = PGROUNDUP((uint64)pa_start);
+  uint64 top = PGROUNDDOWN((uint64)pa_end);
+  int order;
+
+  while(p < top){
+    for(order = MAXORDER; order > 0; order--)
+      if((p - KERNBASE) % (PGSIZE << order) == 0 && p + (PGSIZE << order) <= top)
+        break;
+    buddyfree((void*)p, order);
+    p += PGSIZE << order;
+  }
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
+// The page goes on the current CPU's free list; if
+// that list has grown long, a batch of pages goes
+// back to the buddy allocator.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *spill;
+  struct kmem *km;
+  int n;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < bootend || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // drop a reference; someone else may still be using the page.
+  int ref = __sync_sub_and_fetch(PA2REF(pa), 1);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: not allocated");
+
+#ifdef KMEMDEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  spill = 0;
+  if(km->nfree > KCACHEMAX){
+    spill = km->freelist;
+    for(n = 1; n < KBATCH; n++)
+      r = r->next;
+    km->freelist = r->next;
+    r->next = 0;
+    km->nfree -= KBATCH;
+  }
+  release(&km->lock);
+  pop_off();
+
+  while(spill){
+    r = spill;
+    spill = r->next;
+    buddyfree(r, 0);
+  }
+}
+
+// Refill CPU id's empty list with a batch of pages from
+// the buddy allocator. Returns 0 if the buddy allocator
+// has no block of that size free.
+// Must be called with interrupts disabled.
+static int
+refill(int id)
+{
+  char *pa;
+  struct run *r;
+  struct kmem *km = &kmem[id];
+
+  if((pa = buddyalloc(KBATCHORDER)) == 0)
+    return 0;
+  acquire(&km->lock);
+  for(int i = 0; i < KBATCH; i++){
+    r = (struct run*)(pa + i*PGSIZE);
+    r->next = km->freelist;
+    km->freelist = r;
+  }
+  km->nfree += KBATCH;
+  km->nrefill++;
+  release(&km->lock);
+  return 1;
+}
+
+// Move up to NSTEAL pages from some other CPU's free list
+// onto CPU id's list. Only one kmem lock is held at a time,
+// so two CPUs stealing from each other cannot deadlock.
+// Must be called with interrupts disabled.
+static void
+steal(int id)
+{
+  struct run *first, *last;
+  struct kmem *victim;
+  int i, n;
+
+  for(i = 1; i < ncpu; i++){
+    victim = &kmem[(id + i) % ncpu];
+    acquire(&victim->lock);
+    first = last = victim->freelist;
+    if(first == 0){
+      release(&victim->lock);
+      continue;
+    }
+    for(n = 1; n < NSTEAL && last->next; n++)
+      last = last->next;
+    victim->freelist = last->next;
+    victim->nfree -= n;
+    victim->nstolen += n;
+    release(&victim->lock);
+
+    acquire(&kmem[id].lock);
+    last->next = kmem[id].freelist;
+    kmem[id].freelist = first;
+    kmem[id].nfree += n;
+    kmem[id].nsteal++;
+    release(&kmem[id].lock);
+    return;
+  }
+}
+
+// Add a reference to an allocated page, e.g. when
+// fork() shares it between parent and child.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < bootend || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  if(__sync_fetch_and_add(PA2REF(pa), 1) < 1)
+    panic("krefinc: not allocated");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(PA2REF(pa), __ATOMIC_SEQ_CST);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +263,262 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+    km->nhit++;
+  }
+  release(&km->lock);
+
+  if(r == 0){
+    if(refill(id) == 0)
+      steal(id);
+    acquire(&km->lock);
+    if((r = km->freelist) != 0){
+      km->freelist = r->next;
+      km->nfree--;
+    } else if((r = km->zerolist) != 0){
+      // a zeroed page will do, rather than fail.
+      km->zerolist = r->next;
+      km->nzero--;
+    }
+    release(&km->lock);
+  }
+  pop_off();
+
+  // out of memory: free cached program text nobody uses.
+  if(r == 0 && textreclaim() > 0)
+    return kalloc();
 
+  if(r)
+    *PA2REF(r) = 1;
+#ifdef KMEMDEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one page of physical memory filled with zeroes.
+// Takes a page from this CPU's pool of pre-zeroed pages
+// when there is one, so the caller doesn't pay for the
+// memset(). Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kmem *km;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  if((r = km->zerolist) != 0){
+    km->zerolist = r->next;
+    km->nzero--;
+    km->nzhit++;
+  } else {
+    km->nzmiss++;
+  }
+  release(&km->lock);
+  pop_off();
+
+  if(r){
+    r->next = 0; // the only word the free list dirtied.
+    *PA2REF(r) = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Called by the scheduler when this CPU has nothing to run.
+// Zeroes one free page and moves it to the CPU's zeroed pool.
+// Returns 1 if it did any work, 0 if the pool is full
+// or there are no free pages to zero.
+int
+kzeroidle(void)
+{
+  struct run *r;
+  struct kmem *km;
+  int id, tries, full;
+
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  for(tries = 0; tries < 2; tries++){
+    acquire(&km->lock);
+    r = 0;
+    full = km->nzero >= KZEROMAX;
+    if(!full && (r = km->freelist) != 0){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
+    if(r || full || refill(id) == 0)
+      break;
+  }
+  pop_off();
+
+  if(r == 0)
+    return 0;
+
+  // the page is on no list, so zero it without holding the
+  // lock. the scheduler never moves to another CPU, so km
+  // is still this CPU's.
+  memset((char*)r, 0, PGSIZE);
+
+  push_off();
+  acquire(&km->lock);
+  r->next = km->zerolist;
+  km->zerolist = r;
+  km->nzero++;
+  release(&km->lock);
+  pop_off();
+  return 1;
+}
+
+// Return every page on every CPU's list to the buddy
+// allocator, so that it can merge them into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *r, *list;
+
+  for(int i = 0; i < ncpu; i++){
+    acquire(&kmem[i].lock);
+    list = kmem[i].freelist;
+    kmem[i].freelist = 0;
+    kmem[i].nfree = 0;
+    release(&kmem[i].lock);
+    while(list){
+      r = list;
+      list = r->next;
+      buddyfree(r, 0);
+    }
+
+    acquire(&kmem[i].lock);
+    list = kmem[i].zerolist;
+    kmem[i].zerolist = 0;
+    kmem[i].nzero = 0;
+    release(&kmem[i].lock);
+    while(list){
+      r = list;
+      list = r->next;
+      buddyfree(r, 0);
+    }
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size, from the buddy allocator; if drain, try
+// again after returning the per-CPU lists' pages to it.
+static void *
+kallocblock(int order, int drain)
+{
+  void *pa;
+
+  if((pa = buddyalloc(order)) == 0){
+    // pages sitting on per-CPU lists may complete a block.
+    if(!drain)
+      return 0;
+    kdrain();
+    if((pa = buddyalloc(order)) == 0)
+      return 0;
+  }
+  // each page gets its own reference, so that pieces
+  // of the block can later be freed with kfree().
+  for(int i = 0; i < (1 << order); i++)
+    *PA2REF((char*)pa + i*PGSIZE) = 1;
+#ifdef KMEMDEBUG
+  memset(pa, 5, PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Order 0 is the same as kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *
+kallocpages(int order)
+{
+  if(order == 0)
+    return kalloc();
+  return kallocblock(order, 1);
+}
+
+// Like kallocpages(), but only if the buddy allocator has
+// a block free already: for callers that can do without,
+// and may try often, for whom emptying every CPU's lists
+// each time would cost more than the block is worth.
+void *
+ktrypages(int order)
+{
+  if(order == 0)
+    return kalloc();
+  return kallocblock(order, 0);
+}
+
+// Free 2^order pages returned by kallocpages().
+void
+kfreepages(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < bootend ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfreepages");
+  for(int i = 0; i < (1 << order); i++)
+    if(__sync_sub_and_fetch(PA2REF((char*)pa + i*PGSIZE), 1) != 0)
+      panic("kfreepages: shared");
+
+#ifdef KMEMDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  buddyfree(pa, order);
+}
+
+// Roughly how many pages are free, on the per-CPU lists
+// and in the buddy allocator. Takes no locks; swap.c uses
+// it to decide when to start swapping.
+uint64
+kfreecount(void)
+{
+  uint64 n = buddynfree();
+
+  for(int i = 0; i < ncpu; i++)
+    n += kmem[i].nfree + kmem[i].nzero;
+  return n;
+}
+
+// Report per-CPU allocator counters for the statistics device.
+int
+statskalloc(char *buf, int sz)
+{
+  int n = 0;
+  struct kmem *km;
+
+  for(int i = 0; i < ncpu; i++){
+    km = &kmem[i];
+    acquire(&km->lock);
+    if(km->nhit || km->nrefill || km->nsteal || km->nfree || km->nzero)
+      n += snprintf(buf+n, sz-n, "kmem cpu%d: free %ld zeroed %ld hit %ld refill %ld steal %ld stolen %ld zhit %ld zmiss %ld\n",
+                    i, km->nfree + km->nzero, km->nzero, km->nhit, km->nrefill,
+                    km->nsteal, km->nstolen, km->nzhit, km->nzmiss);
+    release(&km->lock);
+  }
+  return n;
+}
@@ -6,37 +6,93 @@
 
 volatile static int started = 0;
 
+// when each phase of booting ended, in nanoseconds since
+// reset. main() records the early ones, forkret() the file
+// system's, and exec() the first program's, which prints
+// them all.
+static struct {
+  char *name;
+  uint64 ns;
+} phases[16];
+static int nphase;
+static int printed;
+
+// only one CPU is booting at a time, so no lock.
+void
+bootphase(char *name)
+{
+  if(nphase < NELEM(phases)){
+    phases[nphase].name = name;
+    phases[nphase].ns = clock_ns();
+    nphase++;
+  }
+}
+
+void
+bootprint(void)
+{
+  uint64 prev;
+
+  if(printed || nphase == 0)
+    return;
+  printed = 1;
+  prev = phases[0].ns;
+  for(int i = 0; i < nphase; i++){
+    printf("boot: %s at %dus (+%dus)\n", phases[i].name,
+           (int)(phases[i].ns / 1000), (int)((phases[i].ns - prev) / 1000));
+    prev = phases[i].ns;
+  }
+}
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
 {
   if(cpuid() == 0){
+    // the console comes first, at the UART's physical
+    // address, so that panics during boot can print.
     consoleinit();
     printfinit();
-    printf("\n");
-    printf("xv6 kernel is booting\n");
-    printf("\n");
+    dtbinit();       // size of RAM, number of CPUs, timebase
+    bootphase("dtbinit");
     kinit();         // physical page allocator
+    bootphase("kinit");
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    uartremap();     // the UART is now at its DEVBASE address
+    bootphase("kvminit");
+    printf("\n");
+    printf("xv6 kernel is booting\n");
+    printf("%d MB of memory, %d cpus\n", (int)((PHYSTOP - KERNBASE) >> 20), ncpu);
+    printf("\n");
     procinit();      // process table
+    bootphase("procinit");
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    bootphase("binit");
     iinit();         // inode table
+    textinit();      // shared program text cache
+    swapinit();      // swap area
     fileinit();      // file table
+    pipeinit();      // pipe slab cache
+    vmainit();       // shared mapping slab cache
+    statsinit();     // statistics device
+    bootphase("tables");
     virtio_disk_init(); // emulated hard disk
+    bootphase("disk");
     userinit();      // first user process
+    bootphase("userinit");
     __sync_synchronize();
     started = 1;
   } else {
     while(started == 0)
       ;
     __sync_synchronize();
-    printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
+    printf("hart %d starting\n", cpuid());
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
   }
@@ -10,28 +10,45 @@
 // 10001000 -- virtio disk 
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
-// unused RAM after 80000000.
+// unused RAM after 80000000, up to the size given
+// with -m; qemu puts the device tree near its end.
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// the kernel maps device registers at DEVBASE plus their
+// physical address, in the gigabyte below the trampoline,
+// so that no kernel mapping uses the lowest gigabyte of
+// virtual addresses, where most user memory is. see
+// kvmcreate() in vm.c.
+#define DEVBASE (MAXVA - (1L << 30))
+
 // qemu puts UART registers here in physical memory.
-#define UART0 0x10000000L
+#define UART0_PA 0x10000000L
+#define UART0 (DEVBASE + UART0_PA)
 #define UART0_IRQ 10
 
 // virtio mmio interface
-#define VIRTIO0 0x10001000
+#define VIRTIO0_PA 0x10001000L
+#define VIRTIO0 (DEVBASE + VIRTIO0_PA)
 #define VIRTIO0_IRQ 1
 
-// core local interruptor (CLINT), which contains the timer.
+// core local interruptor (CLINT), which contains the timer,
+// and each hart's machine software interrupt pending bit.
+// the kernel maps them to send interprocessor interrupts
+// and to program each hart's next timer interrupt.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define KCLINT_MSIP(hartid) (DEVBASE + CLINT_MSIP(hartid))
+#define KCLINT_MTIMECMP(hartid) (DEVBASE + CLINT_MTIMECMP(hartid))
 
 // qemu puts platform-level interrupt controller (PLIC) here.
-#define PLIC 0x0c000000L
+#define PLIC_PA 0x0c000000L
+#define PLIC (DEVBASE + PLIC_PA)
 #define PLIC_PRIORITY (PLIC + 0x0)
 #define PLIC_PENDING (PLIC + 0x1000)
 #define PLIC_SENABLE(hart) (PLIC + 0x2080 + (hart)*0x100)
@@ -40,9 +57,15 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to PHYSTOP, which
+// dtbinit() reads from the device tree at boot. the
+// kernel uses at most PHYSMAX of it.
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSMAX (KERNBASE + (16L << 30))
+#ifndef __ASSEMBLER__
+extern uint64 phystop;
+#endif
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -1,5 +1,7 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         4  // scheduling priority levels, see runq.c
+#define TICKUS   100000  // microseconds in a clock tick, the time slice unit
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -10,4 +12,9 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE     32768 // size of swap area in blocks, after the file system
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest buddy block is 2^MAXORDER pages
+#define NVMA         16    // program segments and mappings per process
+#define NTEXTPAGE    512   // pages in the shared program text cache
+#define MEGAMIN      256   // heap pages in use before a megapage replaces them
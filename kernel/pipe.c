@@ -7,8 +7,10 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 #define PIPESIZE 512
+#define PIPECHUNK 128 // bytes copied to or from user space at a time
 
 struct pipe {
   struct spinlock lock;
@@ -17,8 +19,19 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a piperead() is copying out bytes it hasn't consumed yet
 };
 
+// pipes are much smaller than a page,
+// so allocate them from a slab cache.
+static struct kmem_cache pipecache;
+
+void
+pipeinit(void)
+{
+  kmem_cache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +41,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(&pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->reading = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +61,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(&pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,36 +82,44 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// pipewrite() and piperead() copy to and from user space
+// through a buffer on the stack, without holding pi->lock:
+// the user page may have to be read in from disk. piperead()
+// consumes the bytes only once they are copied out, and
+// meanwhile keeps other readers away with pi->reading.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
   struct proc *pr = myproc();
+  char buf[PIPECHUNK];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i < PIPECHUNK ? n - i : PIPECHUNK;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -105,26 +127,36 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i = 0, j, r = 0;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->reading || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  pi->reading = 1;
+  while(i < n && pi->nread != pi->nwrite){
+    for(j = 0; i + j < n && j < PIPECHUNK; j++){  //DOC: piperead-copy
+      if(pi->nread + j == pi->nwrite)
+        break;
+      buf[j] = pi->data[(pi->nread + j) % PIPESIZE];
+    }
+    release(&pi->lock);
+    r = copyout(pr->pagetable, addr + i, buf, j);
+    acquire(&pi->lock);
+    if(r != 0)
       break;
+    pi->nread += j;
+    i += j;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pi->reading = 0;
+  wakeup(&pi->nread);
   release(&pi->lock);
-  return i;
+  return r == 0 || i > 0 ? i : -1;
 }
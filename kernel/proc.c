@@ -51,6 +51,7 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  runqinit();
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +125,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();  // start on the parent's run queue
+  p->nice = p->prio = p->slice = 0;
+  p->weight = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -140,6 +144,14 @@ found:
     return 0;
   }
 
+  // A kernel page table that maps it.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -149,6 +161,15 @@ found:
   return p;
 }
 
+// Mark p RUNNABLE and put it on a run queue.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  runqput(p);
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
@@ -158,6 +179,9 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -168,6 +192,8 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->nfault = 0;
+  p->asidgen = 0;
   p->state = UNUSED;
 }
 
@@ -188,7 +214,7 @@ proc_pagetable(struct proc *p)
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
+              (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0){
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -249,12 +275,31 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
+// Start a kernel thread: a process with no user memory
+// that runs fn in the kernel and never returns to user
+// space. fn starts holding p->lock, as forkret() does,
+// and must release it.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; vmfault() allocates each
+// new page when the process first touches it.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -264,11 +309,14 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > TRAPFRAME || vmaoverlap(p, PGROUNDUP(sz), sz + n))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // uvmdealloc() leaves the size alone if it fails.
+    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) == p->sz)
+      return -1;
+    vmatrunc(p, sz);
   }
   p->sz = sz;
   return 0;
@@ -289,7 +337,7 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 || vmacopy(np, p) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
@@ -310,6 +358,10 @@ fork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->nice = np->prio = p->nice;
+  np->weight = p->weight;
+  np->vruntime = p->vruntime;
+
   pid = np->pid;
 
   release(&np->lock);
@@ -319,7 +371,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -360,6 +412,9 @@ exit(int status)
     }
   }
 
+  // Write back and unmap mmap()ed files.
+  vmaunmap(p, 0, MAXVA);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -391,7 +446,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -406,14 +461,20 @@ wait(uint64 addr)
 
         havekids = 1;
         if(pp->state == ZOMBIE){
-          // Found one.
+          // Found one. Copy out its status only after
+          // dropping the locks, since copyout may sleep,
+          // and free it only once that has worked, so that
+          // a bad addr doesn't lose it. Only p reaps pp, so
+          // it stays a ZOMBIE meanwhile.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -437,7 +498,8 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue, or
+//    steal one from another CPU's (see runq.c).
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -454,22 +516,39 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqget()) == 0){
+      // nothing to run: make sure kswapd knows if memory
+      // is low, use the time to zero free pages for
+      // kalloc_zeroed(), and once there are enough, wait
+      // for an interrupt.
+      kswapdwake();
+      if(kzeroidle() == 0)
+        runqidle();
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = c - cpus;
+    c->proc = p;
+    runqstart(p);
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // If it yielded, it goes back on a queue only now that
+    // it is off this CPU's stack.
+    c->proc = 0;
+    runqdone(p);
+    release(&p->lock);
   }
 }
 
@@ -506,7 +585,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->state = RUNNABLE;  // scheduler() puts it on a queue
   sched();
   release(&p->lock);
 }
@@ -526,6 +605,9 @@ forkret(void)
     // regular process (e.g., because it calls sleep), and thus cannot
     // be run from main().
     fsinit(ROOTDEV);
+    bootphase("fsinit");  // includes log recovery
+    swapon(ROOTDEV);
+    bootphase("swapon");
 
     first = 0;
     // ensure other cores see first=0.
@@ -577,7 +659,7 @@ wakeup(void *chan)
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
@@ -598,7 +680,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -682,7 +764,25 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s faults %d", p->pid, state, p->name, (int)p->nfault);
     printf("\n");
   }
 }
+
+// Report per-process page fault counts and scheduling
+// levels for the statistics device.
+int
+statsproc(char *buf, int sz)
+{
+  struct proc *p;
+  int n = 0;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->state != UNUSED)
+      n += snprintf(buf+n, sz-n, "proc %d %s: faults %ld prio %d nice %d weight %d\n",
+                    p->pid, p->name, p->nfault, p->prio, p->nice, p->weight);
+    release(&p->lock);
+  }
+  return n;
+}
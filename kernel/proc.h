@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation whose TLB entries are all this hart may hold
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +80,22 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A range of user memory whose pages vmfault() fills in
+// the first time they are touched, from a file or with
+// zeroes. See vma.c.
+struct vma {
+  uint64 start;                // first address, page-aligned
+  uint64 end;                  // one past the last, page-aligned
+  int perm;                    // PTE_R, PTE_W, PTE_X, PTE_U
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, VMA_MMAP; 0 if slot is free
+  struct inode *ip;            // backing file, or 0 for anonymous memory
+  uint64 off;                  // file offset of start
+  uint64 filesz;               // bytes from the file; the rest are zero
+  struct shm *shm;             // pages of a MAP_SHARED area, see vma.c
+};
+
+#define VMA_MMAP 0x100         // made by mmap(), above p->sz
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,6 +108,18 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU that last ran it, whose run queue it joins
+  int nice;                    // Level that boosts raise it to, see nice()
+  int weight;                  // Share in the fair class, or 0; see setweight()
+  uint64 runstart;             // r_time() when last charged for running
+
+  // p->lock, or while p is on a run queue, the queue's lock
+  // must be held when using these:
+  struct proc *rqnext;         // Next on the run queue, see runq.c
+  int prio;                    // Run queue level, 0 runs first
+  uint64 slice;                // Time CSR cycles used at this level
+  uint boost;                  // Priority boosts applied to it
+  uint64 vruntime;             // Weighted time CSR cycles run, in the fair class
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -99,9 +128,16 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, see kvmcreate()
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  uint64 nfault;               // Page faults resolved by vmfault()
+  int asid;                    // Address space identifier, see uvmsatp()
+  uint64 asidgen;              // ASID generation that asid belongs to
+  int tlbcpu;                  // Last hart to run this process in user space
+  int tlbflush;                // Page table changed since then
+  struct vma vma[NVMA];        // Demand-filled memory areas
 };
@@ -40,9 +40,23 @@ w_mepc(uint64 x)
   asm volatile("csrw mepc, %0" : : "r" (x));
 }
 
+// Machine ISA Register, misa: one bit per extension letter.
+#define MISA_V (1L << ('V' - 'A')) // vector extension
+
+static inline uint64
+r_misa()
+{
+  uint64 x;
+  asm volatile("csrr %0, misa" : "=r" (x) );
+  return x;
+}
+
 // Supervisor Status Register, sstatus
 
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
+#define SSTATUS_SUM (1L << 18) // Supervisor may use User pages
+#define SSTATUS_VS (3L << 9)   // vector unit state; 0 means off
+#define SSTATUS_VS_INITIAL (1L << 9)
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
 #define SSTATUS_SIE (1L << 1)  // Supervisor Interrupt Enable
@@ -201,6 +215,14 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address space identifier field of satp. TLB entries
+// are tagged with the ASID they were loaded under, so
+// address spaces with different ASIDs can share the TLB.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  (0xffffL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -242,6 +264,8 @@ r_stval()
 }
 
 // Machine-mode Counter-Enable
+#define MCOUNTEREN_CY (1L << 0) // supervisor may read the cycle CSR
+#define MCOUNTEREN_TM (1L << 1) // supervisor may read the time CSR
 static inline void 
 w_mcounteren(uint64 x)
 {
@@ -256,7 +280,60 @@ r_mcounteren()
   return x;
 }
 
-// machine-mode cycle counter
+// Machine Environment Configuration; csr 0x30a, by number
+// since older assemblers don't know the name.
+#define MENVCFG_STCE (1L << 63) // Sstc: supervisor may use stimecmp
+static inline void
+w_menvcfg(uint64 x)
+{
+  asm volatile("csrw 0x30a, %0" : : "r" (x));
+}
+
+static inline uint64
+r_menvcfg()
+{
+  uint64 x;
+  asm volatile("csrr %0, 0x30a" : "=r" (x) );
+  return x;
+}
+
+// Supervisor Timer Compare (Sstc); csr 0x14d. a supervisor
+// timer interrupt is pending while time >= stimecmp.
+static inline void
+w_stimecmp(uint64 x)
+{
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
+// Supervisor-mode Counter-Enable
+#define SCOUNTEREN_CY (1L << 0) // user may read the cycle CSR
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+// clock cycles since reset. user mode may read it once
+// start() sets mcounteren.CY and scounteren.CY.
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
+// time since reset, in ticks of the timebase frequency
+// (see dtb.c). supervisor mode may read it once start()
+// sets mcounteren.TM.
 static inline uint64
 r_time()
 {
@@ -327,6 +404,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush one page's TLB entries in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -338,11 +429,29 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a level-1 leaf PTE maps a 2-megabyte megapage.
+#define MEGAPGSIZE (512*PGSIZE)
+#define MEGAPGROUNDUP(sz)  (((sz)+MEGAPGSIZE-1) & ~(MEGAPGSIZE-1))
+#define MEGAPGROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // global: the same in every address space
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+
+// bits 8 and 9 are reserved for the supervisor.
+#define PTE_COW (1L << 8) // copy-on-write: shared, and writable once copied
+
+// an invalid PTE with PTE_SWAP set names a page that was
+// swapped out: the PPN field holds its swap slot, and the
+// other flags are those the page had (see swap.c).
+#define PTE_SWAP (1L << 9)
+#define SWAP2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SWAP(pte) ((uint)((pte) >> 10))
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,6 +460,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a valid PTE with any of R, W, X set is a leaf;
+// otherwise it points to the next level's page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
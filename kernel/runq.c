@@ -0,0 +1,568 @@
+// Per-CPU run queues, with a multi-level feedback queue
+// and a fair-share class.
+//
+// Each CPU keeps a queue of RUNNABLE processes, so that
+// scheduler() finds the next process to run under one
+// lock of its own, instead of taking every process's
+// lock in turn while all CPUs scan the same proc[].
+//
+// A process joins the queue of p->cpu, the CPU that last
+// ran it, whenever it becomes RUNNABLE: a woken or yielding
+// process goes back to where its memory is likely cached,
+// and a new one starts on its parent's CPU (see
+// allocproc()). A CPU whose queue is empty steals a
+// process from the longest sibling queue.
+//
+// Most processes are scheduled by a multi-level feedback
+// queue. Each queue has NPRIO levels, and a CPU runs the
+// first process of the highest non-empty level (0 is
+// highest). A process may run for QUANTUM(level) at a
+// level, counted across sleeps, before runqtick() moves it
+// down one; so processes that compute drift down, and ones
+// that mostly wait for input stay near the top. Every
+// BOOSTTICKS ticks, every process goes back up to the
+// level nice() set for it, 0 unless it asked, so that
+// nothing waits forever.
+//
+// A process that calls setweight() instead joins the fair
+// class, which shares the CPU in proportion to weight: the
+// time it runs is added to its virtual runtime, scaled by
+// NICE0/weight, and each queue keeps its fair processes in
+// a heap and runs the one with the least. The fair class
+// runs after the feedback queue's upper levels, whose
+// processes soon drop to the bottom level if they compute,
+// and before the bottom level, whose processes the boosts
+// still bring up to run now and then.
+//
+// There is no periodic timer interrupt. A CPU programs its
+// timer (see timerarm() in trap.c) for the end of the
+// running process's time slice only while another process
+// waits on its queue, and otherwise only for the earliest
+// sleep() deadline. Time used while alone is charged the
+// next time runqtick() runs, all at once.
+//
+// A CPU with nothing to run waits in wfi (see runqidle()),
+// rather than spinning on the queues' locks. Whoever puts
+// a process on a queue sends an interprocessor interrupt
+// to that CPU if it is idle, or else to another idle CPU,
+// which will steal the process; failing both, to a busy
+// CPU whose queue was empty, so that it arms its timer.
+//
+// Lock order: p->lock, then a run queue's lock. runqget()
+// hands back a process without its lock; it is RUNNABLE
+// and on no queue, so nothing else will run it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define QUANTUM(level) (tickcycles << (level))  // time CSR cycles
+#define BOOSTTICKS 50
+
+#define NICE0     1024       // the weight whose virtual time is real time
+#define MAXWEIGHT (1 << 16)
+#define WAKELAG   (tickcycles / 2)  // a woken process may trail the queue this much
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];  // next to run; linked by p->rqnext
+  struct proc *tail[NPRIO];
+  struct proc *heap[NPROC];  // fair processes, least vruntime first
+  int nheap;
+  uint64 minvruntime; // never decreases; new fair processes start here
+  int n;              // processes on the queue
+  uint boost;         // boosts this queue has applied
+  uint64 npick;       // processes this CPU ran
+  uint64 nsteal;      // of those, taken from a sibling's queue
+  uint64 nstolen;     // processes siblings took from this queue
+  uint64 ndemote;     // times a process here dropped a level
+  uint64 picktime;    // time CSR ticks spent choosing them
+  int idle;           // 1 while the CPU waits for work in wfi
+  uint64 idletime;    // time CSR ticks spent there
+  uint64 nipi;        // interprocessor interrupts sent to the CPU
+  uint64 ntimer;      // timer interrupts the CPU took
+  uint64 timerlag;    // time CSR ticks they arrived late, in all
+};
+
+static struct runq runq[NCPU];
+
+void
+runqinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+}
+
+// How many boosts there have been. Nothing needs to run
+// at each one: each process and queue notices on its own
+// that it has fallen behind.
+static uint
+boosts(void)
+{
+  return r_time() / (tickcycles * BOOSTTICKS);
+}
+
+// Raise p to its nice level, if there has been a boost
+// since it last looked. Caller must hold p->lock, or the
+// lock of the queue p is on.
+static void
+boost(struct proc *p)
+{
+  uint b = boosts();
+
+  if(p->boost != b){
+    p->boost = b;
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// Add the time p has run since p->runstart to its slice,
+// and to its virtual runtime. Caller must hold p->lock.
+static void
+charge(struct proc *p)
+{
+  uint64 now = r_time();
+
+  p->slice += now - p->runstart;
+  if(p->weight)
+    p->vruntime += (now - p->runstart) * NICE0 / p->weight;
+  p->runstart = now;
+}
+
+// How long p may run before this CPU should look at its
+// queue again, if other processes wait there: to the end
+// of p's quantum at its level, but no more than a tick.
+// Caller must hold p->lock.
+static uint64
+slicetime(struct proc *p)
+{
+  if(p->weight == 0 && p->slice + tickcycles > QUANTUM(p->prio))
+    return QUANTUM(p->prio) > p->slice ? QUANTUM(p->prio) - p->slice : 1;
+  return tickcycles;
+}
+
+static void
+heapswap(struct runq *rq, int i, int j)
+{
+  struct proc *p = rq->heap[i];
+
+  rq->heap[i] = rq->heap[j];
+  rq->heap[j] = p;
+}
+
+static void
+heappush(struct runq *rq, struct proc *p)
+{
+  int i = rq->nheap++;
+
+  rq->heap[i] = p;
+  while(i > 0 && rq->heap[(i-1)/2]->vruntime > rq->heap[i]->vruntime){
+    heapswap(rq, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static struct proc*
+heappop(struct runq *rq)
+{
+  struct proc *p = rq->heap[0];
+  int i = 0, c;
+
+  rq->heap[0] = rq->heap[--rq->nheap];
+  while((c = 2*i + 1) < rq->nheap){
+    if(c + 1 < rq->nheap && rq->heap[c+1]->vruntime < rq->heap[c]->vruntime)
+      c++;
+    if(rq->heap[i]->vruntime <= rq->heap[c]->vruntime)
+      break;
+    heapswap(rq, i, c);
+    i = c;
+  }
+  if(p->vruntime > rq->minvruntime)
+    rq->minvruntime = p->vruntime;
+  return p;
+}
+
+// Caller must hold rq->lock.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  if(p->weight){
+    heappush(rq, p);
+  } else {
+    p->rqnext = 0;
+    if(rq->tail[p->prio])
+      rq->tail[p->prio]->rqnext = p;
+    else
+      rq->head[p->prio] = p;
+    rq->tail[p->prio] = p;
+  }
+  rq->n++;
+}
+
+// Take the first process at a level of the feedback queue,
+// or 0. Caller must hold rq->lock.
+static struct proc*
+listpop(struct runq *rq, int level)
+{
+  struct proc *p;
+
+  if((p = rq->head[level]) != 0){
+    rq->head[level] = p->rqnext;
+    if(rq->head[level] == 0)
+      rq->tail[level] = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  return p;
+}
+
+// Take the process that should run next: the first of the
+// highest non-empty level above the bottom one, else the
+// fair process with the least virtual runtime, else the
+// first at the bottom level. Caller must hold rq->lock.
+static struct proc*
+dequeue(struct runq *rq)
+{
+  struct proc *p;
+
+  for(int i = 0; i < NPRIO-1; i++)
+    if((p = listpop(rq, i)) != 0)
+      return p;
+  if(rq->nheap > 0){
+    rq->n--;
+    return heappop(rq);
+  }
+  return listpop(rq, NPRIO-1);
+}
+
+// Send an interprocessor interrupt to CPU id, through the
+// CLINT, to wake it from wfi.
+static void
+ipi(int id)
+{
+  __sync_fetch_and_add(&runq[id].nipi, 1);
+  *(volatile uint32*)KCLINT_MSIP(id) = 1;
+}
+
+// A process has just joined CPU id's queue, which was
+// empty if first. Wake id if it is idle, or else some other
+// idle CPU to steal it, unless id is this CPU and it is in
+// scheduler(), about to choose. If id was running a process
+// alone, it has no timer armed to preempt it: arm one.
+// Caller must have interrupts off.
+static void
+kick(int id, int first)
+{
+  int me = cpuid();
+
+  // pairs with the one in runqidle(): either that CPU
+  // sees the process, or this one sees the CPU is idle.
+  __sync_synchronize();
+  if(id == me && mycpu()->proc == 0)
+    return;
+  if(id == me && first)
+    timerarm(tickcycles);
+  if(__sync_bool_compare_and_swap(&runq[id].idle, 1, 0)){
+    ipi(id);
+    return;
+  }
+  for(int i = 0; i < ncpu; i++){
+    if(i != me && __sync_bool_compare_and_swap(&runq[i].idle, 1, 0)){
+      ipi(i);
+      return;
+    }
+  }
+  // the IPI makes id call runqtick(), which arms the timer.
+  if(id != me && first)
+    ipi(id);
+}
+
+// Append p to the queue of p->cpu.
+// Caller must hold p->lock, and p must be RUNNABLE.
+void
+runqput(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+  int first;
+
+  if(!holding(&p->lock) || p->state != RUNNABLE)
+    panic("runqput");
+  boost(p);
+  acquire(&rq->lock);
+  // a fair process that slept for a while must not then
+  // have the CPU to itself until it catches up.
+  if(p->weight && rq->minvruntime > WAKELAG && p->vruntime < rq->minvruntime - WAKELAG)
+    p->vruntime = rq->minvruntime - WAKELAG;
+  enqueue(rq, p);
+  first = rq->n == 1;
+  release(&rq->lock);
+  kick(p->cpu, first);
+}
+
+// Apply any boosts rq has missed to the processes on its
+// feedback queue. Caller must hold rq->lock.
+static void
+rqboost(struct runq *rq)
+{
+  struct proc *list = 0, **tailp = &list, *p;
+  uint b = boosts();
+
+  if(rq->boost == b)
+    return;
+  rq->boost = b;
+  for(int i = 0; i < NPRIO; i++){
+    while((p = listpop(rq, i)) != 0){
+      *tailp = p;
+      tailp = &p->rqnext;
+    }
+  }
+  while((p = list) != 0){
+    list = p->rqnext;
+    boost(p);
+    enqueue(rq, p);
+  }
+}
+
+// Take a process from the longest queue but id's. The
+// lengths are read without locks; a stale one only makes
+// this pick a worse victim, or find nothing this time.
+static struct proc*
+steal(int id)
+{
+  struct runq *rq;
+  struct proc *p;
+  int victim = -1, most = 0;
+  uint64 min;
+
+  for(int i = 0; i < ncpu; i++){
+    if(i != id && runq[i].n > most){
+      most = runq[i].n;
+      victim = i;
+    }
+  }
+  if(victim < 0)
+    return 0;
+
+  rq = &runq[victim];
+  acquire(&rq->lock);
+  rqboost(rq);
+  if((p = dequeue(rq)) != 0){
+    rq->nstolen++;
+    // virtual runtimes only compare within a queue: keep
+    // p's distance behind the minimum as it moves.
+    if(p->weight){
+      min = runq[id].minvruntime;
+      if(rq->minvruntime - p->vruntime > min)
+        p->vruntime = 0;
+      else
+        p->vruntime = min - (rq->minvruntime - p->vruntime);
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Choose the next process for this CPU to run, and take
+// it off its queue. Returns 0 if no CPU has a process
+// waiting. Called only by scheduler(), which never moves
+// to another CPU.
+struct proc*
+runqget(void)
+{
+  struct runq *rq;
+  struct proc *p;
+  uint64 t0 = r_time();
+  int id, stolen = 0;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+  rq = &runq[id];
+
+  acquire(&rq->lock);
+  rqboost(rq);
+  p = dequeue(rq);
+  release(&rq->lock);
+  if(p == 0){
+    if((p = steal(id)) == 0)
+      return 0;
+    stolen = 1;
+  }
+
+  acquire(&rq->lock);
+  rq->npick++;
+  rq->nsteal += stolen;
+  rq->picktime += r_time() - t0;
+  release(&rq->lock);
+  return p;
+}
+
+// Called by scheduler() when no queue has a process for
+// this CPU: wait in wfi for an interrupt, from the timer,
+// a device, or kick(), that may have made one RUNNABLE.
+void
+runqidle(void)
+{
+  struct runq *rq;
+  uint64 t0;
+  int any = 0;
+
+  // interrupts are off from here to the wfi, so that none
+  // is handled in between and leaves the wfi waiting. wfi
+  // still wakes up for them.
+  intr_off();
+  rq = &runq[cpuid()];
+  rq->idle = 1;
+  __sync_synchronize();
+  for(int i = 0; i < ncpu; i++)
+    if(runq[i].n > 0)
+      any = 1;
+  if(!any){
+    timerarm(0);
+    t0 = r_time();
+    asm volatile("wfi");
+    rq->idletime += r_time() - t0;
+  }
+  rq->idle = 0;
+  intr_on();
+}
+
+// Called by scheduler() as it starts to run p: start the
+// clock on p, and arm the timer for the end of its slice
+// if others are waiting. Caller must hold p->lock.
+void
+runqstart(struct proc *p)
+{
+  p->runstart = r_time();
+  timerarm(runq[p->cpu].n > 0 ? slicetime(p) : 0);
+}
+
+// Called by scheduler() when p, which it ran, gives up the
+// CPU: charge p for the time, and if p yielded, put it back
+// on a queue. Caller must hold p->lock.
+void
+runqdone(struct proc *p)
+{
+  charge(p);
+  if(p->state == RUNNABLE)
+    runqput(p);
+}
+
+// Called on each timer interrupt or IPI by the process
+// running on this CPU. Charges it for the time since the
+// last call, and returns 1 if it should yield(): it has
+// used up its time at this level, and dropped a level, and
+// others are waiting; or a process that runs before it is
+// waiting on this CPU's queue. Otherwise arms the timer
+// for when to look again.
+int
+runqtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  int y = 0, expired = 0;
+  uint64 next;
+
+  acquire(&p->lock);
+  rq = &runq[p->cpu];
+  charge(p);
+  acquire(&rq->lock);
+  if(p->weight){
+    for(int i = 0; i < NPRIO-1; i++)
+      if(rq->head[i])
+        y = 1;
+    if(rq->nheap > 0 && rq->heap[0]->vruntime < p->vruntime)
+      y = 1;
+  } else {
+    boost(p);
+    // having run alone, p may have used several quanta.
+    while(p->slice >= QUANTUM(p->prio)){
+      p->slice -= QUANTUM(p->prio);
+      expired = 1;
+      if(p->prio < NPRIO-1){
+        p->prio++;
+        rq->ndemote++;
+      }
+    }
+    if(expired && rq->n > 0)
+      y = 1;
+    for(int i = 0; i < p->prio && i < NPRIO-1; i++)
+      if(rq->head[i])
+        y = 1;
+    if(p->prio == NPRIO-1 && rq->nheap > 0)
+      y = 1;
+  }
+  next = rq->n > 0 ? slicetime(p) : 0;
+  release(&rq->lock);
+  release(&p->lock);
+  if(!y)
+    timerarm(next);
+  return y;
+}
+
+// Move the calling process to the fair class with the
+// given weight, NICE0 being an ordinary share, or back to
+// the feedback queue if weight is 0.
+int
+runqsetweight(int weight)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+
+  if(weight < 0 || weight > MAXWEIGHT)
+    return -1;
+  acquire(&p->lock);
+  rq = &runq[p->cpu];
+  charge(p);
+  if(weight && p->weight == 0){
+    acquire(&rq->lock);
+    p->vruntime = rq->minvruntime;
+    release(&rq->lock);
+  } else if(weight == 0 && p->weight){
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+  p->weight = weight;
+  release(&p->lock);
+  return 0;
+}
+
+// Called on each timer interrupt, to count them, and how
+// long after the time it was set for it arrived.
+void
+runqtimer(uint64 lag)
+{
+  push_off();
+  runq[cpuid()].ntimer++;
+  runq[cpuid()].timerlag += lag;
+  pop_off();
+}
+
+// Report per-CPU run queue counters for the statistics
+// device. pickns is the average time to choose a process,
+// idlems the time spent in wfi, timer the number of timer
+// interrupts taken, and timerns how late, on average, they
+// reached the kernel.
+int
+statsrunq(char *buf, int sz)
+{
+  struct runq *rq;
+  int n = 0;
+
+  for(int i = 0; i < ncpu; i++){
+    rq = &runq[i];
+    acquire(&rq->lock);
+    n += snprintf(buf+n, sz-n, "sched cpu%d: queued %d fair %d pick %ld steal %ld stolen %ld demote %ld pickns %ld idlems %ld ipi %ld timer %ld timerns %ld\n",
+                  i, rq->n, rq->nheap, rq->npick, rq->nsteal, rq->nstolen, rq->ndemote,
+                  rq->npick ? rq->picktime * 1000 / rq->npick * 1000000 / timebase : 0,
+                  rq->idletime * 1000 / timebase, rq->nipi, rq->ntimer,
+                  rq->ntimer ? rq->timerlag * 1000 / rq->ntimer * 1000000 / timebase : 0);
+    release(&rq->lock);
+  }
+  return n;
+}
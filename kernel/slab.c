@@ -0,0 +1,236 @@
+// Slab allocator for small, fixed-size kernel objects.
+//
+// A kmem_cache hands out objects of one size. It carves
+// whole pages from kalloc() into slabs: a struct slab
+// header at the start of the page, followed by as many
+// objects as fit. Because a slab is exactly one page, the
+// slab owning an object is found by rounding the object's
+// address down to a page boundary.
+//
+// In front of the slabs each CPU has a magazine, a small
+// stack of free objects that it allocates from and frees
+// to with only interrupts disabled. The cache lock is
+// taken only to refill an empty magazine or to drain a
+// full one, a batch of objects at a time.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+// a slab: lives at the start of its page.
+struct slab {
+  struct slab *next;      // on cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *freelist;         // free objects in this slab
+  int inuse;              // allocated objects, including those in magazines
+};
+
+#define SLABOBJS(c) ((char*)(c) + sizeof(struct slab))
+
+static struct spinlock cachelistlock;
+static struct kmem_cache *caches; // all caches, for statistics
+
+// Set up a cache of objects of the given size, which
+// must be small enough for at least one to fit in a slab.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  static int first = 1;
+
+  if(first){
+    initlock(&cachelistlock, "caches");
+    first = 0;
+  }
+
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if(size + sizeof(struct slab) > PGSIZE)
+    panic("kmem_cache_init: size");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial = 0;
+  c->nslab = 0;
+  c->nempty = 0;
+  memset(c->mag, 0, sizeof(c->mag));
+
+  acquire(&cachelistlock);
+  c->next = caches;
+  caches = c;
+  release(&cachelistlock);
+}
+
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slabpush(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Carve a fresh page into a slab of free objects.
+// Caller holds c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = SLABOBJS(s) + i * c->size;
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slabpush(c, s);
+  c->nslab++;
+  c->nempty++;
+  return s;
+}
+
+// Move up to n objects from slabs into magazine m.
+// Caller holds c->lock.
+static void
+magfill(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n > 0){
+    if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+      return;
+    if(s->inuse == 0)
+      c->nempty--;
+    while(n > 0 && s->freelist){
+      obj = s->freelist;
+      s->freelist = *(void**)obj;
+      s->inuse++;
+      m->objs[m->n++] = obj;
+      n--;
+    }
+    if(s->freelist == 0)
+      slabunlink(c, s); // full slabs are on no list.
+  }
+}
+
+// Return the n objects on top of magazine m to their
+// slabs, freeing slab pages that become empty as long
+// as another empty slab remains cached.
+// Caller holds c->lock.
+static void
+magdrain(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0 && m->n > 0){
+    obj = m->objs[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->freelist == 0)
+      slabpush(c, s); // was full.
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+    if(--s->inuse == 0){
+      if(c->nempty > 0){
+        slabunlink(c, s);
+        c->nslab--;
+        kfree((void*)s);
+      } else {
+        c->nempty++;
+      }
+    }
+  }
+}
+
+// Allocate one object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    magfill(c, m, MAGSIZE / 2);
+    release(&c->lock);
+    m->nmiss++;
+  }
+  if(m->n > 0){
+    obj = m->objs[--m->n];
+    m->nalloc++;
+  }
+  pop_off();
+  return obj;
+}
+
+// Return an object to the cache it was allocated from.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    magdrain(c, m, MAGSIZE / 2);
+    release(&c->lock);
+  }
+  m->objs[m->n++] = obj;
+  m->nfree++;
+  pop_off();
+}
+
+// Report per-cache usage for the statistics device.
+int
+statsslab(char *buf, int sz)
+{
+  struct kmem_cache *c;
+  uint64 nalloc, nfree, nmiss;
+  int n = 0;
+
+  acquire(&cachelistlock);
+  for(c = caches; c; c = c->next){
+    nalloc = nfree = nmiss = 0;
+    for(int i = 0; i < ncpu; i++){
+      nalloc += c->mag[i].nalloc;
+      nfree += c->mag[i].nfree;
+      nmiss += c->mag[i].nmiss;
+    }
+    acquire(&c->lock);
+    n += snprintf(buf+n, sz-n, "slab %s: size %d active %ld slabs %ld alloc %ld free %ld magmiss %ld\n",
+                  c->name, c->size, nalloc - nfree, c->nslab, nalloc, nfree, nmiss);
+    release(&c->lock);
+  }
+  release(&cachelistlock);
+  return n;
+}
@@ -0,0 +1,24 @@
+#define MAGSIZE 16  // objects per per-CPU magazine
+
+// A CPU's stack of free objects for one cache.
+// Only touched by its own CPU, with interrupts off.
+struct magazine {
+  int n;                  // objects in objs[]
+  void *objs[MAGSIZE];
+  uint64 nalloc;          // objects allocated on this CPU
+  uint64 nfree;           // objects freed on this CPU
+  uint64 nmiss;           // allocations that found the magazine empty
+};
+
+// A cache of equal-sized kernel objects; see slab.c.
+struct kmem_cache {
+  struct spinlock lock;   // protects the slab lists and counts
+  char *name;
+  uint size;              // object size, rounded up to a pointer
+  uint perslab;           // objects per slab page
+  struct slab *partial;   // slabs with at least one free object
+  uint64 nslab;           // slab pages owned by this cache
+  uint64 nempty;          // slabs with no objects in use
+  struct magazine mag[NCPU];
+  struct kmem_cache *next; // list of all caches
+};
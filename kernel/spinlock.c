@@ -108,3 +108,18 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// May the caller sleep, i.e. is push_off() not in effect,
+// as it is while holding a spinlock? Unlike reading
+// mycpu()->noff directly, safe with interrupts on, when
+// the process may move to another hart at any moment.
+int
+cansleep(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n == 1;
+}
@@ -0,0 +1,118 @@
+//
+// formatted output into a buffer, for the statistics device.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int
+sputc(char *s, int off, int sz, char c)
+{
+  if(off < sz)
+    s[off] = c;
+  return 1;
+}
+
+static int
+sprintint(char *s, int off, int sz, uint64 xx, int base, int sign)
+{
+  char buf[24];
+  int i, n;
+  uint64 x;
+
+  if(sign && (sign = (long)xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[i++] = '-';
+
+  n = 0;
+  while(--i >= 0)
+    n += sputc(s, off+n, sz, buf[i]);
+  return n;
+}
+
+// Print into buf, which holds sz bytes, and NUL-terminate it.
+// Understands %d, %x, %p, %s, and %ld/%lx for 64-bit values.
+// Returns the number of characters stored, not counting the NUL.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, off;
+  char *s;
+
+  if(sz <= 0)
+    return 0;
+
+  off = 0;
+  va_start(ap, fmt);
+  for(i = 0; (c = fmt[i] & 0xff) != 0 && off < sz - 1; i++){
+    if(c != '%'){
+      off += sputc(buf, off, sz - 1, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      off += sprintint(buf, off, sz - 1, (long)va_arg(ap, int), 10, 1);
+      break;
+    case 'x':
+      off += sprintint(buf, off, sz - 1, va_arg(ap, uint), 16, 0);
+      break;
+    case 'l':
+      c = fmt[++i] & 0xff;
+      if(c == 'd')
+        off += sprintint(buf, off, sz - 1, va_arg(ap, uint64), 10, 1);
+      else if(c == 'x')
+        off += sprintint(buf, off, sz - 1, va_arg(ap, uint64), 16, 0);
+      else
+        i--;
+      break;
+    case 'p':
+      off += sputc(buf, off, sz - 1, '0');
+      off += sputc(buf, off, sz - 1, 'x');
+      off += sprintint(buf, off, sz - 1, va_arg(ap, uint64), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        off += sputc(buf, off, sz - 1, *s);
+      break;
+    case '%':
+      off += sputc(buf, off, sz - 1, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off += sputc(buf, off, sz - 1, '%');
+      off += sputc(buf, off, sz - 1, c);
+      break;
+    }
+  }
+  va_end(ap);
+
+  if(off > sz - 1)
+    off = sz - 1;
+  buf[off] = 0;
+  return off;
+}
@@ -11,14 +11,17 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][6];
 
-// assembly code in kernelvec.S for machine-mode timer interrupt.
+// assembly code in kernelvec.S for machine-mode timer and
+// software interrupts.
 extern void timervec();
+extern int sstcprobe();
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0, with
+// the physical address of the device tree.
 void
-start()
+start(uint64 dtb)
 {
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
@@ -46,17 +49,36 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let supervisor mode read the time, for boot timestamps,
+  // and user mode the cycle counter, for benchmarks.
+  w_mcounteren(r_mcounteren() | MCOUNTEREN_TM | MCOUNTEREN_CY);
+  w_scounteren(r_scounteren() | SCOUNTEREN_CY);
+
+#ifdef RVV
+  // only machine mode can tell whether the hart has the
+  // vector extension, for string.c.
+  if(r_misa() & MISA_V)
+    rvv = 1;
+#endif
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
 
+  // for dtbinit().
+  if(id == 0)
+    dtbpa = dtb;
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
 
-// arrange to receive timer interrupts.
-// they will arrive in machine mode at
-// at timervec in kernelvec.S,
+// arrange to receive timer interrupts, and interprocessor
+// interrupts from other harts' ipi().
+// if the hart has the Sstc extension, timer interrupts go
+// straight to supervisor mode, from stimecmp. otherwise,
+// and for interprocessor interrupts always, they arrive
+// in machine mode at timervec in kernelvec.S,
 // which turns them into software interrupts for
 // devintr() in trap.c.
 void
@@ -65,17 +87,27 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // no timer interrupt until the kernel asks for one
+  // with timerarm() in trap.c.
+  *(uint64*)CLINT_MTIMECMP(id) = ~0ULL;
+
+  // STCE is writable only if the hart has Sstc, and
+  // menvcfg itself may be missing, so let sstcprobe()
+  // in kernelvec.S try it.
+  if(sstcprobe()){
+    w_stimecmp(~0ULL);
+    sstc = 1;
+  }
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : address of CLINT MSIP register.
+  // scratch[5] : set by timervec on each timer interrupt, for devintr().
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[4] = CLINT_MSIP(id);
+  scratch[5] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +116,7 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode software interrupts, and timer
+  // interrupts unless stimecmp replaces them.
+  w_mie(r_mie() | MIE_MSIE | (sstc ? 0 : MIE_MTIE));
 }
@@ -0,0 +1,90 @@
+//
+// The statistics device: reading it returns a text
+// snapshot of counters kept by various kernel subsystems.
+// init creates it as the file "statistics".
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+// room for the longest lines there can be: a kmem line
+// (under 256 bytes) and a sched line (under 384) per CPU,
+// a proc line (under 128) per process, and a page for the
+// handful of others, slab caches included. snprintf()
+// would cut a snapshot that didn't fit short silently.
+#define BUFSZ (PGSIZE + NCPU*(256+384) + NPROC*128)
+
+static struct {
+  struct sleeplock lock;  // not a spinlock: copyout may sleep
+  char buf[BUFSZ];
+  int sz;   // bytes in buf; 0 means take a new snapshot.
+  int off;  // next byte of buf to hand to a reader.
+} stats;
+
+// Fill stats.buf with a fresh snapshot.
+// Each subsystem appends its own lines.
+static int
+statssnapshot(char *buf, int sz)
+{
+  int n = 0;
+
+  n += statskalloc(buf+n, sz-n);
+  n += statsbuddy(buf+n, sz-n);
+  n += statsslab(buf+n, sz-n);
+  n += statsvm(buf+n, sz-n);
+  n += statstext(buf+n, sz-n);
+  n += statsswap(buf+n, sz-n);
+  n += statsrunq(buf+n, sz-n);
+  n += statsproc(buf+n, sz-n);
+  return n;
+}
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+// Hand out the current snapshot. Once a reader has seen
+// all of it, return 0 (end of file) and arrange for the
+// next read to take a new snapshot.
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquiresleep(&stats.lock);
+  if(stats.sz == 0){
+    stats.sz = statssnapshot(stats.buf, BUFSZ);
+    stats.off = 0;
+  }
+  m = stats.sz - stats.off;
+  if(m > 0){
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) == -1)
+      m = -1;
+    else
+      stats.off += m;
+  } else {
+    m = 0;
+    stats.sz = 0;
+  }
+  releasesleep(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initsleeplock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
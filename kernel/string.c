@@ -1,13 +1,83 @@
 #include "types.h"
+#ifdef RVV
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+#endif
+
+// memset(), memmove(), memcmp() and strncpy() work eight
+// bytes at a time once their pointers are aligned, with
+// byte loops only for unaligned heads and tails, or for
+// pointers that can never be aligned at the same time.
+
+#define WSIZE sizeof(uint64)
+#define WALIGNED(p) (((uint64)(p) & (WSIZE - 1)) == 0)
+#define COALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) & (WSIZE - 1)) == 0)
+
+// nonzero if some byte of w is zero.
+#define HASZERO(w) (((w) - 0x0101010101010101L) & ~(w) & 0x8080808080808080L)
+
+#ifdef RVV
+// With RVV=1, memset() and memmove() of at least RVVMIN
+// bytes use the vector extension, on harts that have it
+// (start() sets rvv). The kernel doesn't save the vector
+// registers across traps or context switches, so they are
+// used only with interrupts off, and sstatus.VS is on
+// only meanwhile; user space never sees them.
+#define RVVMIN 256
+
+int rvv;
+
+void rvvmemset(void*, int, uint64);       // stringv.S
+void rvvmemcpy(void*, const void*, uint64);
+
+static void
+rvvbegin(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+static void
+rvvend(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+#endif
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = (uchar*)dst;
+  uint64 w;
+
+#ifdef RVV
+  if(rvv && n >= RVVMIN){
+    rvvbegin();
+    rvvmemset(dst, c, n);
+    rvvend();
+    return dst;
+  }
+#endif
+  while(n > 0 && !WALIGNED(d)){
+    *d++ = c;
+    n--;
+  }
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, d += 4*WSIZE){
+    ((uint64*)d)[0] = w;
+    ((uint64*)d)[1] = w;
+    ((uint64*)d)[2] = w;
+    ((uint64*)d)[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE, d += WSIZE)
+    *(uint64*)d = w;
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +88,17 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(COALIGNED(s1, s2)){
+    while(n > 0 && !WALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes below find the
+    // difference within a word that differs.
+    while(n >= WSIZE && *(uint64*)s1 == *(uint64*)s2)
+      s1 += WSIZE, s2 += WSIZE, n -= WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -41,11 +122,47 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    // equal alignment means d - s >= WSIZE, so
+    // copying a word at a time backwards is safe.
+    if(COALIGNED(s, d)){
+      while(n > 0 && !WALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+#ifdef RVV
+    if(rvv && n >= RVVMIN){
+      rvvbegin();
+      rvvmemcpy(d, s, n);
+      rvvend();
+      return dst;
+    }
+#endif
+    if(COALIGNED(s, d)){
+      while(n > 0 && !WALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, d += 4*WSIZE, s += 4*WSIZE){
+        ((uint64*)d)[0] = ((const uint64*)s)[0];
+        ((uint64*)d)[1] = ((const uint64*)s)[1];
+        ((uint64*)d)[2] = ((const uint64*)s)[2];
+        ((uint64*)d)[3] = ((const uint64*)s)[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -73,10 +190,27 @@ strncpy(char *s, const char *t, int n)
   char *os;
 
   os = s;
-  while(n-- > 0 && (*s++ = *t++) != 0)
-    ;
-  while(n-- > 0)
-    *s++ = 0;
+  if(COALIGNED(s, t)){
+    while(n > 0 && !WALIGNED(t)){
+      n--;
+      if((*s++ = *t++) == 0)
+        goto pad;
+    }
+    // an aligned word never straddles a page boundary,
+    // so reading past the end of t here cannot fault.
+    while(n >= WSIZE && !HASZERO(*(const uint64*)t)){
+      *(uint64*)s = *(const uint64*)t;
+      s += WSIZE, t += WSIZE, n -= WSIZE;
+    }
+  }
+  while(n > 0){
+    n--;
+    if((*s++ = *t++) == 0)
+      break;
+  }
+pad:
+  if(n > 0)
+    memset(s, 0, n);
   return os;
 }
 
@@ -0,0 +1,487 @@
+// Swapping of anonymous user memory.
+//
+// mkfs reserves a swap area on the disk after the file
+// system (sb.swapstart, sb.nswap), divided into page-sized
+// slots. When free memory falls below SWAPLOW pages, the
+// kswapd kernel thread moves the clock hand over the user
+// memory of processes that aren't running: a page whose
+// accessed bit is set gets a second chance (the bit is
+// cleared), a page whose bit is still clear is written to
+// a free slot and freed, until SWAPHIGH pages are free. A
+// page fault that finds no memory at all does the same
+// itself (see kalloc_user()), and may take pages from the
+// faulting process too.
+//
+// A swapped-out page's PTE is left invalid, with PTE_SWAP
+// set and the slot number where the physical address
+// was. The next fault on it (see vmfault()) reads it back.
+// fork() shares the slot, like copy-on-write shares a
+// page: each slot counts the PTEs that name it.
+//
+// Only private pages that no other page table shares are
+// swapped out; MAP_SHARED pages stay put. A megapage that
+// goes unused for a lap of the hand is split, so that its
+// pages can be swapped out one at a time.
+//
+// swap.lock is taken with a process's p->lock held, so
+// it must never be held while acquiring another lock,
+// sleeping, or calling wakeup().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)   // disk blocks per slot
+#define NSLOT (SWAPSIZE / SLOTBLOCKS)
+#define SWAPLOW 256     // kswapd starts below this many free pages
+#define SWAPHIGH 512    // and stops once this many are free
+#define SWAPBATCH 16    // pages detached before writing them out
+#define SCANMAX 512     // PTEs looked at per hold of a p->lock
+#define NSWAPIO 4       // disk transfers in progress at once
+
+extern struct proc proc[NPROC];
+extern struct superblock sb;
+
+// pages detached from their page tables, to be written out.
+struct batch {
+  int n;
+  int full;                // the swap area has no free slot
+  uint slot[SWAPBATCH];
+  char *pa[SWAPBATCH];
+};
+
+static struct {
+  struct spinlock lock;
+  uint start;              // first swap block
+  uint nslot;              // 0 if there is no swap area
+  uint used;               // slots with references
+  uint hint;               // where to start looking for a free slot
+  ushort ref[NSLOT];       // PTEs that name each slot
+  char *wb[NSLOT];         // page still being written to each slot
+  uint64 nout, nin;        // pages written out and read back
+
+  // the clock hand: only moved by whoever holds reclaim.
+  struct sleeplock reclaim;
+  int hand;                // index in proc[]
+  uint64 handva;           // next user address to look at
+
+  struct spinlock iolock;
+  int iobusy[NSWAPIO];
+  struct buf io[NSWAPIO];
+
+  struct spinlock idlelock;
+  int idle;                // kswapd is asleep, waiting for kswapdwake()
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initlock(&swap.iolock, "swapio");
+  initsleeplock(&swap.reclaim, "reclaim");
+  initlock(&swap.idlelock, "kswapd");
+}
+
+// Read or write the page at pa from or to slot s, a block
+// at a time, bypassing the buffer cache. May sleep.
+static void
+swapio(uint s, char *pa, int write)
+{
+  struct buf *b;
+  int i;
+
+  acquire(&swap.iolock);
+  for(;;){
+    for(i = 0; i < NSWAPIO; i++)
+      if(!swap.iobusy[i])
+        break;
+    if(i < NSWAPIO)
+      break;
+    sleep(swap.iobusy, &swap.iolock);
+  }
+  swap.iobusy[i] = 1;
+  release(&swap.iolock);
+
+  b = &swap.io[i];
+  b->dev = ROOTDEV;
+  for(int k = 0; k < SLOTBLOCKS; k++){
+    b->blockno = swap.start + s * SLOTBLOCKS + k;
+    if(write)
+      memmove(b->data, pa + k * BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if(!write)
+      memmove(pa + k * BSIZE, b->data, BSIZE);
+  }
+
+  acquire(&swap.iolock);
+  swap.iobusy[i] = 0;
+  wakeup(swap.iobusy);
+  release(&swap.iolock);
+}
+
+// Find a free slot and give it one reference.
+// Returns -1 if there is none. Caller holds swap.lock.
+static int
+slotalloc(void)
+{
+  uint s;
+
+  for(uint i = 0; i < swap.nslot; i++){
+    s = (swap.hint + i) % swap.nslot;
+    // a slot whose page is still being written is not
+    // free yet, even if nothing refers to it any more.
+    if(swap.ref[s] == 0 && swap.wb[s] == 0){
+      swap.ref[s] = 1;
+      swap.used++;
+      swap.hint = s + 1;
+      return s;
+    }
+  }
+  return -1;
+}
+
+// Is the page that PTE pte maps at va one that can be
+// swapped out? Caller holds p->lock.
+static int
+swappable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if((pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if(krefcnt((void*)PTE2PA(pte)) != 1)
+    return 0;
+  if((v = vmalookup(p, va)) != 0 && (v->flags & MAP_SHARED))
+    return 0;
+  return 1;
+}
+
+// Look at up to SCANMAX of p's level-0 PTEs, starting at
+// va, detaching pages to swap out into b. Returns where
+// to start next time, or MAXVA if p is done with.
+// Caller holds p->lock, and p is not running on another
+// hart.
+static uint64
+scan(struct proc *p, uint64 va, struct batch *b)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  uint64 pa;
+  int s, n, stale = 0;
+
+  for(n = 0; n < SCANMAX && va < MAXVA && b->n < SWAPBATCH && !b->full; n++){
+    pte = &p->pagetable[PX(2, va)];
+    if((*pte & PTE_V) == 0){
+      va = (va | ((1L << PXSHIFT(2)) - 1)) + 1;
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(1, va)];
+    if((*pte & PTE_V) && PTE_LEAF(*pte) && swappable(p, va, *pte)){
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        stale = 1;
+      } else if(uvmsplit(p->pagetable, va) == 0)
+        continue;
+    }
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE;
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(0, va)];
+    if(!swappable(p, va, *pte)){
+      va += PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_A){
+      // second chance.
+      *pte &= ~PTE_A;
+      stale = 1;
+      va += PGSIZE;
+      continue;
+    }
+
+    pa = PTE2PA(*pte);
+    acquire(&swap.lock);
+    if((s = slotalloc()) >= 0)
+      swap.wb[s] = (char*)pa;
+    release(&swap.lock);
+    if(s < 0){
+      b->full = 1;
+      break;
+    }
+    *pte = SWAP2PTE(s) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+    stale = 1;
+    b->slot[b->n] = s;
+    b->pa[b->n] = (char*)pa;
+    b->n++;
+    va += PGSIZE;
+  }
+
+  // p's stale TLB entries go before it runs again: those of
+  // pages swapped out, and those of pages whose accessed bit
+  // was cleared, or the hardware would never set it again.
+  if(stale){
+    p->tlbcpu = -1;
+    p->tlbflush = 1;
+    // the current process goes on running here.
+    if(p == myproc())
+      sfence_vma();
+  }
+  return va;
+}
+
+// Move the clock hand until b holds SWAPBATCH pages, the
+// swap area is full, or the hand has gone once around.
+// Caller holds swap.reclaim.
+static void
+collect(struct batch *b)
+{
+  struct proc *p;
+  int lap = 0;
+
+  b->n = 0;
+  b->full = 0;
+  while(lap <= NPROC && b->n < SWAPBATCH && !b->full){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if((p == myproc() || p->state == RUNNABLE || p->state == SLEEPING) && p->pagetable){
+      swap.handva = scan(p, swap.handva, b);
+    } else {
+      swap.handva = MAXVA;
+    }
+    release(&p->lock);
+    if(swap.handva >= MAXVA){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+      lap++;
+    }
+  }
+}
+
+// Swap pages out until target pages are free, or until
+// the hand has twice gone around finding nothing (once to
+// clear accessed bits, once more to take pages). May
+// sleep.
+static void
+reclaim(uint64 target)
+{
+  struct batch b;
+  int i, idle = 0;
+
+  acquiresleep(&swap.reclaim);
+  while(kfreecount() < target && idle < 2){
+    collect(&b);
+    if(b.n == 0){
+      if(b.full)
+        break;
+      idle++;
+      continue;
+    }
+    idle = 0;
+    for(i = 0; i < b.n; i++)
+      swapio(b.slot[i], b.pa[i], 1);
+    // a fault may have taken a page back while it was
+    // being written (see swapin()); free the others.
+    acquire(&swap.lock);
+    for(i = 0; i < b.n; i++){
+      if(swap.wb[b.slot[i]] == b.pa[i])
+        swap.wb[b.slot[i]] = 0;
+      else
+        b.pa[i] = 0;
+    }
+    swap.nout += b.n;
+    release(&swap.lock);
+    for(i = 0; i < b.n; i++)
+      if(b.pa[i])
+        kfree(b.pa[i]);
+  }
+  releasesleep(&swap.reclaim);
+}
+
+// Allocate a page of user memory for the current process,
+// zeroed if zero is set. If memory has run out, swap
+// other processes' pages out to make room, unless the
+// caller holds a spinlock and so cannot sleep.
+// Returns 0 if no page can be had.
+void*
+kalloc_user(int zero)
+{
+  void *mem;
+
+  for(int tries = 0; ; tries++){
+    if((mem = zero ? kalloc_zeroed() : kalloc()) != 0){
+      if(cansleep())
+        kswapdwake();
+      return mem;
+    }
+    if(swap.nslot == 0 || tries == 3 || !cansleep())
+      return 0;
+    reclaim(SWAPHIGH);
+  }
+}
+
+// Bring back the page that the swap PTE *pte names, for a
+// fault by the current process, and map it with the
+// flags it had. May sleep.
+// Returns the page's physical address, or 0 if out of
+// memory or if the caller holds a spinlock.
+uint64
+swapin(pte_t *pte)
+{
+  uint s = PTE2SWAP(*pte);
+  char *mem = 0, *spare;
+
+  if(!cansleep())
+    return 0;
+  for(;;){
+    acquire(&swap.lock);
+    if(swap.wb[s] && swap.ref[s] == 1){
+      // still in memory, and ours alone: take it back.
+      spare = mem;
+      mem = swap.wb[s];
+      swap.wb[s] = 0;
+      swap.ref[s] = 0;
+      swap.used--;
+      swap.nin++;
+      release(&swap.lock);
+      if(spare)
+        kfree(spare);
+      goto map;
+    }
+    if(swap.wb[s] && mem){
+      // still in memory, but shared since fork().
+      memmove(mem, swap.wb[s], PGSIZE);
+      swap.ref[s]--;
+      swap.nin++;
+      release(&swap.lock);
+      goto map;
+    }
+    release(&swap.lock);
+    if(mem)
+      break;
+    if((mem = kalloc_user(0)) == 0)
+      return 0;
+  }
+
+  // the PTE holds a reference, so the slot can't be
+  // reused while we read it.
+  swapio(s, mem, 0);
+  acquire(&swap.lock);
+  if(--swap.ref[s] == 0)
+    swap.used--;
+  swap.nin++;
+  release(&swap.lock);
+
+ map:
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  return (uint64)mem;
+}
+
+// Another PTE names the same slot as swap PTE pte; for fork().
+void
+swapdup(pte_t pte)
+{
+  uint s = PTE2SWAP(pte);
+
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0)
+    panic("swapdup");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Swap PTE pte is going away; free its slot if it was the
+// last to name it.
+void
+swapfree(pte_t pte)
+{
+  uint s = PTE2SWAP(pte);
+
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0)
+    panic("swapfree");
+  if(--swap.ref[s] == 0)
+    swap.used--;
+  release(&swap.lock);
+}
+
+// Wake kswapd if free memory has fallen below SWAPLOW.
+// Called by kalloc_user(), and by scheduler() when it has
+// nothing to run, which between them see memory run low
+// soon enough; kalloc() itself can't, since its callers
+// may hold any lock. Caller must not hold a spinlock.
+void
+kswapdwake(void)
+{
+  if(!swap.idle || kfreecount() >= SWAPLOW)
+    return;
+  acquire(&swap.idlelock);
+  wakeup(&swap.idle);
+  release(&swap.idlelock);
+}
+
+// The swap daemon. Like a process returning from fork(),
+// it starts holding its p->lock. Sleeps until free memory
+// falls below SWAPLOW, with no timer armed for it, and
+// then swaps pages out until SWAPHIGH are free.
+static void
+kswapd(void)
+{
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&swap.idlelock);
+    while(kfreecount() >= SWAPLOW){
+      swap.idle = 1;
+      sleep(&swap.idle, &swap.idlelock);
+    }
+    swap.idle = 0;
+    release(&swap.idlelock);
+    reclaim(SWAPHIGH);
+    if(kfreecount() < SWAPLOW){
+      // nothing more to swap out for now; try again in a tick.
+      acquire(&tickslock);
+      tickupdate();
+      tickwakeat(ticks + 1);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+// Start swapping to the swap area of device dev, once the
+// file system is up. Called by the first process.
+void
+swapon(int dev)
+{
+  if(dev != ROOTDEV || sb.nswap < SLOTBLOCKS)
+    return;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  kthread("kswapd", kswapd);
+}
+
+// Report swap usage for the statistics device.
+int
+statsswap(char *buf, int sz)
+{
+  int n;
+
+  acquire(&swap.lock);
+  n = snprintf(buf, sz, "swap: slots %d used %d pageout %ld pagein %ld\n",
+               swap.nslot, swap.used, swap.nout, swap.nin);
+  release(&swap.lock);
+  return n;
+}
@@ -6,6 +6,7 @@
 
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
@@ -503,3 +504,49 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off): addr is only a
+// hint, and is ignored. Returns the address of the
+// mapping, or -1.
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f;
+  struct inode *ip = 0;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(off % PGSIZE != 0)
+    return -1;
+  if((flags & MAP_ANON) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    // changes to a shared mapping reach the file.
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    ip = f->ip;
+  }
+  return vmammap(myproc(), len, prot, flags, ip, off);
+}
+
+// munmap(addr, len): remove the pages of [addr, addr+len)
+// from mmap()ed areas, writing back shared file pages.
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  if(addr % PGSIZE != 0 || len == 0 || addr < PGROUNDUP(p->sz) ||
+     addr + len < addr || addr + len > TRAPFRAME)
+    return -1;
+  return vmaunmap(p, addr, PGROUNDUP(addr + len));
+}
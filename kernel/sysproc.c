@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "fcntl.h"
 
 uint64
 sys_exit(void)
@@ -58,13 +59,16 @@ sys_sleep(void)
   if(n < 0)
     n = 0;
   acquire(&tickslock);
+  tickupdate();
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(killed(myproc())){
       release(&tickslock);
       return -1;
     }
+    tickwakeat(ticks0 + n);
     sleep(&ticks, &tickslock);
+    tickupdate();
   }
   release(&tickslock);
   return 0;
@@ -79,15 +83,68 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// return how many clock ticks have passed since start.
 uint64
 sys_uptime(void)
 {
   uint xticks;
 
   acquire(&tickslock);
+  tickupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
 }
+
+// store the time on the given clock, in nanoseconds, at
+// the user address; only CLOCK_MONOTONIC is kept.
+uint64
+sys_clock_gettime(void)
+{
+  int clock;
+  uint64 addr, ns;
+
+  argint(0, &clock);
+  argaddr(1, &addr);
+  if(clock != CLOCK_MONOTONIC)
+    return -1;
+  ns = clock_ns();
+  if(copyout(myproc()->pagetable, addr, (char*)&ns, sizeof(ns)) < 0)
+    return -1;
+  return 0;
+}
+
+// set the highest scheduling level the process may run at,
+// 0 (the default) to NPRIO-1, and return the old one. a
+// lower level takes effect at once; a higher one at the
+// next boost (see runq.c).
+uint64
+sys_nice(void)
+{
+  struct proc *p = myproc();
+  int n, old;
+
+  argint(0, &n);
+  if(n < 0 || n >= NPRIO)
+    return -1;
+  acquire(&p->lock);
+  old = p->nice;
+  p->nice = n;
+  if(p->prio < n){
+    p->prio = n;
+    p->slice = 0;
+  }
+  release(&p->lock);
+  return old;
+}
+
+// join the fair-share class with the given weight (1024 is
+// an ordinary share), or leave it if the weight is 0.
+uint64
+sys_setweight(void)
+{
+  int weight;
+
+  argint(0, &weight);
+  return runqsetweight(weight);
+}
@@ -0,0 +1,192 @@
+// Cache of read-only program pages, shared between all
+// processes that run the same executable.
+//
+// vmapage() looks here before reading a page of a
+// read-only segment from disk, so every exec() of sh or
+// cat maps the same physical text pages. The cache keeps
+// its own reference to each page (see krefinc()), so a page
+// stays cached after the last process using it exits.
+//
+// Pages are found by (device, inode number, file offset).
+// Writing or truncating a file drops its pages from the
+// cache; processes that have them mapped keep the old
+// contents. When kalloc() runs out of memory it calls
+// textreclaim() to free pages that only the cache uses.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NTBUCKET 31
+
+struct tpage {
+  uint dev;
+  uint inum;
+  uint64 off;
+  void *pa;              // 0 if the entry is free
+  struct tpage *next;    // in hash bucket, or free list
+};
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTEXTPAGE];
+  struct tpage *bucket[NTBUCKET]; // hashed by (dev, inum)
+  struct tpage *free;
+  uint64 nhit, nmiss, ninval, nreclaim;
+} textcache;
+
+#define TBUCKET(dev, inum) (((dev) * 7 + (inum)) % NTBUCKET)
+
+void
+textinit(void)
+{
+  initlock(&textcache.lock, "textcache");
+  for(int i = 0; i < NTEXTPAGE; i++){
+    textcache.page[i].next = textcache.free;
+    textcache.free = &textcache.page[i];
+  }
+}
+
+// Unlink entry t, whose bucket is b, and free its page.
+// Caller holds textcache.lock.
+static void
+tdrop(struct tpage **b, struct tpage *t)
+{
+  struct tpage **pp;
+
+  for(pp = b; *pp != t; pp = &(*pp)->next)
+    ;
+  *pp = t->next;
+  kfree(t->pa);
+  t->pa = 0;
+  t->next = textcache.free;
+  textcache.free = t;
+}
+
+// Return the cached page holding ip's contents at file
+// offset off, with a reference added for the caller,
+// or 0 if it is not cached.
+void*
+textget(struct inode *ip, uint64 off)
+{
+  struct tpage *t;
+  void *pa = 0;
+
+  acquire(&textcache.lock);
+  for(t = textcache.bucket[TBUCKET(ip->dev, ip->inum)]; t; t = t->next){
+    if(t->dev == ip->dev && t->inum == ip->inum && t->off == off){
+      krefinc(t->pa);
+      pa = t->pa;
+      break;
+    }
+  }
+  if(pa)
+    textcache.nhit++;
+  else
+    textcache.nmiss++;
+  release(&textcache.lock);
+  return pa;
+}
+
+// Offer page pa, just read from ip at file offset off, to
+// the cache, which takes its own reference if it keeps it.
+// Caller holds ip's lock, so the file cannot change while
+// the page is being read and cached.
+void
+textput(struct inode *ip, uint64 off, void *pa)
+{
+  struct tpage *t, **b;
+  int i;
+
+  acquire(&textcache.lock);
+  b = &textcache.bucket[TBUCKET(ip->dev, ip->inum)];
+  for(t = *b; t; t = t->next){
+    if(t->dev == ip->dev && t->inum == ip->inum && t->off == off){
+      release(&textcache.lock);
+      return;
+    }
+  }
+  if(textcache.free == 0){
+    // evict a page no process has mapped.
+    for(i = 0; i < NTEXTPAGE; i++){
+      t = &textcache.page[i];
+      if(krefcnt(t->pa) == 1){
+        tdrop(&textcache.bucket[TBUCKET(t->dev, t->inum)], t);
+        textcache.nreclaim++;
+        break;
+      }
+    }
+  }
+  if((t = textcache.free) != 0){
+    textcache.free = t->next;
+    t->dev = ip->dev;
+    t->inum = ip->inum;
+    t->off = off;
+    t->pa = pa;
+    krefinc(pa);
+    t->next = *b;
+    *b = t;
+  }
+  release(&textcache.lock);
+}
+
+// ip's contents are about to change: forget its pages.
+// Caller holds ip's lock.
+void
+textinval(struct inode *ip)
+{
+  struct tpage *t, *next, **b;
+
+  acquire(&textcache.lock);
+  b = &textcache.bucket[TBUCKET(ip->dev, ip->inum)];
+  for(t = *b; t; t = next){
+    next = t->next;
+    if(t->dev == ip->dev && t->inum == ip->inum){
+      tdrop(b, t);
+      textcache.ninval++;
+    }
+  }
+  release(&textcache.lock);
+}
+
+// Free every cached page that no process has mapped.
+// Returns the number of pages freed.
+int
+textreclaim(void)
+{
+  struct tpage *t;
+  int n = 0;
+
+  acquire(&textcache.lock);
+  for(t = textcache.page; t < &textcache.page[NTEXTPAGE]; t++){
+    if(t->pa && krefcnt(t->pa) == 1){
+      tdrop(&textcache.bucket[TBUCKET(t->dev, t->inum)], t);
+      n++;
+    }
+  }
+  textcache.nreclaim += n;
+  release(&textcache.lock);
+  return n;
+}
+
+// Report cache usage for the statistics device.
+int
+statstext(char *buf, int sz)
+{
+  uint64 n = 0;
+
+  acquire(&textcache.lock);
+  for(int i = 0; i < NTEXTPAGE; i++)
+    if(textcache.page[i].pa)
+      n++;
+  n = snprintf(buf, sz, "textcache: pages %ld hit %ld miss %ld inval %ld reclaim %ld\n",
+               n, textcache.nhit, textcache.nmiss, textcache.ninval, textcache.nreclaim);
+  release(&textcache.lock);
+  return n;
+}
@@ -6,20 +6,34 @@
 #include "proc.h"
 #include "defs.h"
 
+// there is no periodic clock interrupt. ticks is the time
+// CSR over tickcycles, brought up to date by tickupdate()
+// whenever someone looks; a hart takes a timer interrupt
+// only when timerarm() asks for one, for the end of a time
+// slice or for the earliest tick a sleeper on it waits for.
 struct spinlock tickslock;
 uint ticks;
+uint64 tickcycles;              // time CSR cycles in a tick
+static uint64 wakeat[NCPU];     // time CSR deadline of each hart's sleepers
+static uint64 armed[NCPU];      // time CSR deadline each hart's timer is set for
+int sstc;                       // harts program stimecmp; set by start()
 
 extern char trampoline[], uservec[], userret[];
+extern char copyuserfail[], copyuserend[]; // copyuser.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
+extern uint64 timer_scratch[NCPU][6];  // start.c
 
 void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  tickcycles = timebase * TICKUS / 1000000;
+  for(int i = 0; i < NCPU; i++)
+    wakeat[i] = ~0ULL;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +79,10 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) != 0){
+    // instruction, load or store page fault on a page
+    // that is paged in on demand or copy-on-write.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,8 +94,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt or IPI,
+  // and the process has used its time slice.
+  if(which_dev == 2 && runqtick())
     yield();
 
   usertrapret();
@@ -119,8 +138,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with the process's ASID.
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -144,14 +164,30 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // don't let user memory stay accessible to whatever runs
+  // next, should this trap yield; restored below.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)copyuser && sepc < (uint64)copyuserend){
+    // a page fault in copyuser() on the current process's
+    // memory. filling in the page may sleep, so enable
+    // interrupts if the copy had them enabled.
+    uint64 va = r_stval();
+    if(sstatus & SSTATUS_SPIE)
+      intr_on();
+    if(kvmfault(va, scause == 15) < 0)
+      sepc = (uint64)copyuserfail;
+    intr_off();
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt or IPI,
+  // and the process has used its time slice.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && runqtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -163,15 +199,79 @@ kerneltrap()
 void
 clockintr()
 {
+  uint64 now = r_time(), when = armed[cpuid()];
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  tickupdate();
   release(&tickslock);
+  // how late the interrupt arrived, for the statistics.
+  runqtimer(now >= when ? now - when : 0);
+}
+
+// bring ticks up to date, and wake this hart's sleepers
+// if their tick has come. caller must hold tickslock.
+void
+tickupdate(void)
+{
+  uint64 now = r_time();
+  int id = cpuid();
+
+  ticks = now / tickcycles;
+  if(now >= wakeat[id]){
+    wakeat[id] = ~0ULL;
+    wakeup(&ticks);
+  }
+}
+
+// arrange for this hart to wakeup(&ticks) when ticks
+// reaches t, the next time it calls timerarm(). a caller
+// about to sleep() will, via scheduler(). caller must hold
+// tickslock.
+void
+tickwakeat(uint t)
+{
+  int id = cpuid();
+
+  if((uint64)t * tickcycles < wakeat[id])
+    wakeat[id] = (uint64)t * tickcycles;
+}
+
+// program this hart's next timer interrupt for slice
+// time CSR cycles from now, or sooner if a sleeper's tick
+// comes first; a slice of 0 means no time slice, only
+// sleepers, if any. with Sstc, in stimecmp; otherwise in
+// the CLINT's mtimecmp, for timervec.
+void
+timerarm(uint64 slice)
+{
+  uint64 when;
+
+  push_off();
+  when = wakeat[cpuid()];
+  if(slice && r_time() + slice < when)
+    when = r_time() + slice;
+  armed[cpuid()] = when;
+  if(sstc)
+    w_stimecmp(when);
+  else
+    *(volatile uint64*)KCLINT_MTIMECMP(cpuid()) = when;
+  pop_off();
+}
+
+// nanoseconds since reset, from the time CSR, which counts
+// at timebase Hz on every hart alike and never goes back.
+// split so that t * 1e9 can't overflow.
+uint64
+clock_ns(void)
+{
+  uint64 t = r_time();
+
+  return t / timebase * 1000000000 + t % timebase * 1000000000 / timebase;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer interrupt or IPI,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -201,18 +301,28 @@ devintr()
       plic_complete(irq);
 
     return 1;
+  } else if(scause == 0x8000000000000005L){
+    // supervisor timer interrupt, from stimecmp (Sstc).
+    // acknowledge it by pushing stimecmp out of reach;
+    // timerarm() sets the next one.
+    w_stimecmp(~0ULL);
+    clockintr();
+    return 2;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart's ipi() (see runq.c), forwarded
+    // by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // every hart keeps its own time. an interprocessor
+    // interrupt has woken an idle hart, or asks a busy one
+    // to look at its queue again (see kick() in runq.c).
+    if(__sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0) != 0)
+      clockintr();
+
     return 2;
   } else {
     return 0;
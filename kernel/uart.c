@@ -11,9 +11,11 @@
 #include "defs.h"
 
 // the UART control registers are memory-mapped
-// at address UART0. this macro returns the
-// address of one of the registers.
-#define Reg(reg) ((volatile unsigned char *)(UART0 + reg))
+// at address uartbase: UART0_PA until main() turns on
+// paging, so early panics can print, and then UART0.
+// this macro returns the address of one of the registers.
+static uint64 uartbase = UART0_PA;
+#define Reg(reg) ((volatile unsigned char *)(uartbase + reg))
 
 // the UART control registers.
 // some have different meanings for
@@ -77,6 +79,14 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
+// paging is on: switch to the UART's address in the
+// kernel page table.
+void
+uartremap(void)
+{
+  uartbase = UART0;
+}
+
 // add a character to the output buffer and tell the
 // UART to start sending if it isn't already.
 // blocks if the output buffer is full.
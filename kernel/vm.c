@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,33 +17,70 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Address space identifiers. Each process has a pair:
+// an even one for its user page table and the next odd one
+// for its kernel page table (see kvmcreate()), so that its
+// TLB entries survive traps and switches to other address
+// spaces; the global kernel page table has ASID 0. ASIDs
+// are handed out in increasing order; when they run out,
+// a new generation starts, and each hart flushes its whole
+// TLB before it next runs a process with ASIDs from the
+// new generation. A process whose ASIDs are from an older
+// generation gets new ones.
+struct {
+  struct spinlock lock;
+  int max;          // largest ASID the harts implement, or 0
+  int next;         // next pair of ASIDs to hand out
+  uint64 gen;       // current generation
+  uint64 nflush;    // per-ASID flushes
+  uint64 nfull;     // whole-TLB flushes at a new generation
+} asids;
+
+// copies between kernel and user memory, by method.
+static struct {
+  uint64 direct;    // by copyuser(), through the kernel page table
+  uint64 walked;    // page by page, through walkaddr()
+} copystats;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, UART0, UART0_PA, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0_PA, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, PLIC, PLIC_PA, 0x400000, PTE_R | PTE_W);
+
+  // CLINT software interrupt registers, for ipi() in runq.c
+  kvmmap(kpgtbl, KCLINT_MSIP(0), CLINT_MSIP(0), PGSIZE, PTE_R | PTE_W);
+
+  // CLINT timer compare registers, for timerarm() in trap.c
+  kvmmap(kpgtbl, KCLINT_MTIMECMP(0), CLINT_MTIMECMP(0), PGSIZE, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages for the 2-megabyte-aligned
+  // bulk of it.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
-  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  // it is global, since every user page table maps it at
+  // the same address too; see proc_pagetable(). the other
+  // kernel mappings are not, because user memory may use
+  // the same virtual addresses; ASID 0 keeps their TLB
+  // entries apart from user ones instead.
+  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
 
   // allocate and map a kernel stack for each process.
   proc_mapstacks(kpgtbl);
@@ -64,12 +103,172 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // the ASID field of satp is WARL: it keeps only the bits
+  // the hart implements, and may keep none.
+  if(cpuid() == 0){
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+    asids.max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+    if(asids.max < 3)
+      asids.max = 0;
+    initlock(&asids.lock, "asid");
+    asids.next = 2;
+    asids.gen = 1;
+  }
+
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Make a kernel page table for a process with user page
+// table pagetable. It maps everything the kernel does, and
+// its other root slots (each a gigabyte of addresses)
+// point to the user page table's level-1 page-table pages,
+// so that the kernel can reach most user memory with plain
+// loads and stores (see copyuser()). Only the root page
+// belongs to the kernel page table.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpt;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  for(int i = 0; i < 512; i++)
+    kpt[i] = (kernel_pagetable[i] & PTE_V) ? kernel_pagetable[i] : pagetable[i];
+  return kpt;
+}
+
+// Flush the current process's kernel page table's TLB
+// entries for user memory, after a change to them.
+static void
+kvmflush(struct proc *p)
+{
+  if(asids.max)
+    sfence_vma_asid(p->asid + 1);
+  else
+    sfence_vma();
+}
+
+// Point the current process's kernel page table at its new
+// user page table, after exec.
+void
+kvmsync(struct proc *p)
+{
+  for(int i = 0; i < 512; i++)
+    if((kernel_pagetable[i] & PTE_V) == 0)
+      p->kpagetable[i] = p->pagetable[i];
+  kvmflush(p);
+}
+
+// Switch this hart to process p's kernel page table, just
+// before the scheduler runs p; or, if p is 0, back to the
+// global one. Flushes the TLB entries p must not use:
+// those of its ASIDs' previous owners, and those left on
+// this hart from before p last moved. The caller holds
+// p->lock.
+void
+kvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 gen;
+
+  if(p == 0){
+    // the scheduler does not use user addresses, and the
+    // next process's page table flushes them if need be.
+    w_satp(MAKE_SATP(kernel_pagetable));
+    return;
+  }
+  if(asids.max == 0){
+    sfence_vma();
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+
+  acquire(&asids.lock);
+  if(p->asidgen != asids.gen){
+    if(asids.next + 1 > asids.max){
+      asids.gen++;
+      asids.next = 2;
+    }
+    p->asid = asids.next;
+    asids.next += 2;
+    p->asidgen = asids.gen;
+    // flush anyway, to order the stores that built the
+    // page tables before the hardware walks them.
+    p->tlbcpu = -1;
+  }
+  gen = asids.gen;
+  release(&asids.lock);
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+    p->tlbflush = 0;
+    __sync_fetch_and_add(&asids.nfull, 1);
+  } else if(p->tlbcpu != id){
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(p->asid + 1);
+    p->tlbflush = 0;
+    __sync_fetch_and_add(&asids.nflush, 1);
+  }
+  p->tlbcpu = id;
+  w_satp(MAKE_SATP_ASID(p->kpagetable, p->asid + 1));
+}
+
+// Return the satp value that runs p in user space, first
+// flushing p's user TLB entries if its page table changed
+// (see uvmflush()). Called with interrupts off, just
+// before returning to user space. Without ASIDs, userret
+// flushes the whole TLB instead.
+uint64
+uvmsatp(struct proc *p)
+{
+  if(asids.max == 0)
+    return MAKE_SATP(p->pagetable);
+  if(p->tlbflush){
+    sfence_vma_asid(p->asid);
+    p->tlbflush = 0;
+    __sync_fetch_and_add(&asids.nflush, 1);
+  }
+  return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// The current process's TLB entries for pagetable may be
+// stale. Flush those of its kernel page table now, and
+// those of the user page table before it next runs in
+// user space. Other page tables are in use on no hart.
+static void
+uvmflush(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable){
+    p->tlbflush = 1;
+    kvmflush(p);
+  }
+}
+
+// Like uvmflush(), for a single page, all right away; for
+// the page faults that fill in one PTE at a time.
+static void
+uvmflushpage(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  if(asids.max){
+    sfence_vma_page(va, p->asid);
+    sfence_vma_page(va, p->asid + 1);
+  } else {
+    sfence_vma_page(va, 0);
+  }
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,26 +281,82 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE in a level-1 page-table page maps a whole
+// 2-megabyte megapage. If va lies in one, walk() returns
+// that level-1 PTE; use walkleaf() to tell the two apart.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walkleaf(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but also set *level, if level is non-zero,
+// to the level of the returned PTE: 1 for a megapage, else 0.
+// If there is no page-table page for va, and alloc is 0,
+// return 0 with *level set to the level of the invalid PTE
+// that should point to it; see walkskip().
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > 0; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        if(l != 1)
+          panic("walk: gigapage");
+        if(level)
+          *level = 1;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(level)
+        *level = l;
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
+  if(level)
+    *level = 0;
   return &pagetable[PX(0, va)];
 }
 
+// After walkleaf() found no page-table page for va, the
+// number of bytes from va to the end of the range that
+// page would have mapped, none of which can be mapped
+// either: the rest of a 2-megabyte range for level 1,
+// of a gigabyte for level 2.
+static uint64
+walkskip(uint64 va, int level)
+{
+  uint64 sz = 1L << PXSHIFT(level);
+
+  return sz - va % sz;
+}
+
+// Return the address of the level-1 PTE for va, which
+// maps va's megapage if it is a leaf. If alloc!=0, create
+// the level-1 page-table page if required.
+static pte_t *
+walkmega(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -110,11 +365,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -122,6 +378,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level == 1)
+    pa += PGROUNDDOWN(va) & (MEGAPGSIZE-1);
   return pa;
 }
 
@@ -136,14 +394,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
-// physical addresses starting at pa.
+// physical addresses starting at pa. Wherever both va and pa
+// are megapage-aligned and a whole megapage remains to be
+// mapped, a single level-1 leaf PTE maps it.
 // va and size MUST be page-aligned.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, end, n;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
@@ -155,47 +415,187 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   if(size == 0)
     panic("mappages: size");
   
-  a = va;
-  last = va + size - PGSIZE;
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+  end = va + size;
+  for(a = va; a < end; a += n, pa += n){
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+      n = MEGAPGSIZE;
+      pte = walkmega(pagetable, a, 1);
+    } else {
+      n = PGSIZE;
+      pte = walk(pagetable, a, 1);
+    }
+    if(pte == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
   }
   return 0;
 }
 
+// Counters for user megapages, for the statistics device.
+// Updated atomically, since any CPU may fault or exit.
+static struct {
+  uint64 mapped;    // megapage PTEs now in user page tables
+  uint64 collapse;  // heap regions promoted to a megapage
+  uint64 split;     // megapage PTEs split into 4K PTEs
+  uint64 nomem;     // promotions that found no free megapage
+} megastats;
+
+// If va lies in a megapage, replace its level-1 leaf PTE
+// with a page-table page of 512 PTEs that map the same
+// pages with the same permissions, so that they can be
+// unmapped or copied one at a time.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+
+  pte = walkmega(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  if((pt = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pt) | PTE_V;
+  uvmflush(pagetable);
+  __sync_fetch_and_sub(&megastats.mapped, 1);
+  __sync_fetch_and_add(&megastats.split, 1);
+  return 0;
+}
+
+// Transparent superpages: heap pages are allocated 4K at
+// a time as the process touches them (see vmfault()), but
+// once MEGAMIN pages of an aligned megapage of heap are in
+// use, copy them into one physically contiguous megapage
+// and map it with a single level-1 PTE, freeing the 4K
+// pages and their page-table page. Only private, writable
+// heap pages that no other process shares qualify.
+// Returns the new physical address of va's page, or 0 if
+// the region was left alone.
+static uint64
+uvmcollapse(struct proc *p, uint64 va)
+{
+  uint64 mva = MEGAPGROUNDDOWN(va);
+  pte_t *l1, pte;
+  pagetable_t pt;
+  char *mem;
+  int i, n = 0;
+
+  if(mva + MEGAPGSIZE > p->sz || vmaoverlap(p, mva, mva + MEGAPGSIZE))
+    return 0;
+  l1 = walkmega(p->pagetable, mva, 0);
+  if(l1 == 0 || (*l1 & PTE_V) == 0 || PTE_LEAF(*l1))
+    return 0;
+  pt = (pagetable_t)PTE2PA(*l1);
+  for(i = 0; i < 512; i++){
+    pte = pt[i];
+    if(pte & PTE_SWAP)
+      return 0;
+    if((pte & PTE_V) == 0)
+      continue;
+    if((PTE_FLAGS(pte) & ~(PTE_A|PTE_D)) != (PTE_V|PTE_R|PTE_W|PTE_U) ||
+       krefcnt((void*)PTE2PA(pte)) != 1)
+      return 0;
+    n++;
+  }
+  if(n < MEGAMIN)
+    return 0;
+  // if this fails, every further fault in the region tries
+  // again; only the first may drain the per-CPU lists.
+  mem = n == MEGAMIN ? kallocpages(9) : ktrypages(9);
+  if(mem == 0){
+    __sync_fetch_and_add(&megastats.nomem, 1);
+    return 0;
+  }
+  for(i = 0; i < 512; i++){
+    pte = pt[i];
+    if(pte & PTE_V){
+      memmove(mem + i*PGSIZE, (char*)PTE2PA(pte), PGSIZE);
+      kfree((void*)PTE2PA(pte));
+    } else {
+      memset(mem + i*PGSIZE, 0, PGSIZE);
+    }
+  }
+  kfree((void*)pt);
+  *l1 = PA2PTE(mem) | PTE_V|PTE_R|PTE_W|PTE_U|PTE_A|PTE_D;
+  uvmflush(p->pagetable);
+  __sync_fetch_and_add(&megastats.mapped, 1);
+  __sync_fetch_and_add(&megastats.collapse, 1);
+  return (uint64)mem + (va - mva);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
+// page-aligned. Pages that were never faulted in (see
+// vmfault()) are skipped, a whole page-table page's worth
+// at a time where there is none. A megapage that is only partly
+// in the range is split first.
+// Optionally free the physical memory, or the swap slot
+// of a page that was swapped out.
+// Returns 0, or -1 if there was no memory to split a
+// megapage, in which case nothing has been unmapped.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, n;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+  if(npages == 0)
+    return 0;
+
+  // only the megapages at either end can be partly in the
+  // range; split them before tearing anything down.
+  for(a = va; ; a = end - PGSIZE){
+    pte = walkleaf(pagetable, a, 0, &level);
+    if(pte && (*pte & PTE_V) && level == 1 &&
+       (MEGAPGROUNDDOWN(a) < va || MEGAPGROUNDDOWN(a) + MEGAPGSIZE > end) &&
+       uvmsplit(pagetable, a) < 0)
+      return -1;
+    if(a == end - PGSIZE)
+      break;
+  }
+
+  for(a = va; a < end; a += n){
+    n = PGSIZE;
+    if((pte = walkleaf(pagetable, a, 0, &level)) == 0){
+      n = walkskip(a, level);
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level == 1){
+      if(a % MEGAPGSIZE != 0 || end - a < MEGAPGSIZE)
+        panic("uvmunmap: partial megapage");
+      n = MEGAPGSIZE;
+      __sync_fetch_and_sub(&megastats.mapped, 1);
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      for(uint64 i = 0; i < n; i += PGSIZE)
+        kfree((void*)(pa + i));
     }
     *pte = 0;
   }
+  uvmflush(pagetable);
+  return 0;
 }
 
 // create an empty user page table.
@@ -204,10 +604,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,8 +620,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -240,12 +638,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -258,7 +655,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if
+// there was no memory to split a megapage.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -267,7 +665,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) < 0)
+      return oldsz;
   }
 
   return newsz;
@@ -305,42 +704,218 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Rather than copying the physical memory, share each
+// page between parent and child; writable pages become
+// read-only and copy-on-write in both, and vmfault()
+// gives a process its own copy when it first writes.
+// Pages the parent never faulted in stay that way.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  return uvmcopyrange(old, new, 0, PGROUNDUP(sz), 0);
+}
+
+// Like uvmcopy(), for the page-aligned range [start, end).
+// If share is set, writable pages stay writable and are
+// shared outright, as MAP_SHARED memory is. Megapages are
+// shared whole, page by page reference counts and all.
+// A swapped-out page's slot is shared; each page table
+// reads in its own copy on its next fault.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
+{
+  pte_t *pte, *npte;
+  uint64 pa, i, n;
   uint flags;
-  char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  for(i = start; i < end; i += n){
+    n = PGSIZE;
+    if((pte = walkleaf(old, i, 0, &level)) == 0){
+      n = walkskip(i, level);
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(level == 1){
+      if(i % MEGAPGSIZE != 0 || end - i < MEGAPGSIZE){
+        if(uvmsplit(old, i) < 0)
+          goto err;
+        pte = walk(old, i, 0);
+      } else {
+        n = MEGAPGSIZE;
+      }
+    }
+    if((*pte & PTE_W) && !share){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      uvmflush(old);
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, n, pa, flags) != 0)
       goto err;
-    }
+    for(uint64 j = 0; j < n; j += PGSIZE)
+      krefinc((void*)(pa + j));
+    if(n == MEGAPGSIZE)
+      __sync_fetch_and_add(&megastats.mapped, 1);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Resolve a page fault at user virtual address va.
+// write is non-zero if the faulting access was a store.
+//
+// An unmapped page of the current process is allocated on
+// first touch: program text and data are read in from the
+// executable (see exec() and vma.c), mmap()ed pages from
+// their file or zero-filled, and heap pages that sbrk()
+// added are zero-filled.
+//
+// A store to a copy-on-write page gives the page table
+// its own writable copy, unless it is the last sharer,
+// in which case the page just becomes writable again.
+// A copy-on-write megapage is split first, and only the
+// page written to is copied.
+//
+// A page that was swapped out is read back in (see swap.c).
+// Pages are allocated with kalloc_user(), which may swap
+// other processes' pages out to make room.
+//
+// Returns the physical address of the page,
+// or 0 if the fault can't be resolved.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v = 0;
+  pte_t *pte, old;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int level;
+
+  if(va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  pte = walkleaf(pagetable, va, 0, &level);
+  if(pte && (*pte & PTE_SWAP)){
+    if(p == 0 || pagetable != p->pagetable)
+      return 0;
+    if((pa = swapin(pte)) == 0)
+      return 0;
+    p->nfault++;
+    uvmflushpage(pagetable, va);
+    if(!write || (*pte & PTE_W))
+      return pa;
+    // a store to a read-only page: copy-on-write, or not allowed.
+  } else if(pte == 0 || (*pte & PTE_V) == 0){
+    if(p == 0 || pagetable != p->pagetable)
+      return 0;
+    if((v = vmalookup(p, va)) != 0){
+      if((v->perm & PTE_R) == 0 || (write && (v->perm & PTE_W) == 0))
+        return 0;
+      // reading the file, or waiting for a shm, may
+      // sleep, which a caller holding a spinlock cannot do.
+      if((v->ip || v->shm) && !cansleep())
+        return 0;
+      if((mem = vmapage(v, va)) == 0)
+        return 0;
+      flags = v->perm;
+    } else if(va < p->sz){
+      if((mem = kalloc_user(1)) == 0)
+        return 0;
+      flags = PTE_R|PTE_W|PTE_U;
+    } else {
+      return 0;
+    }
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, flags) != 0){
+      kfree(mem);
+      return 0;
+    }
+    p->nfault++;
+    uvmflushpage(pagetable, va);
+    if(v == 0 && (pa = uvmcollapse(p, va)) != 0)
+      return pa;
+    return (uint64)mem;
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  // a fault on a mapped page is a protection violation
+  // unless it is a store to a copy-on-write page.
+  if(!write || (*pte & PTE_COW) == 0)
+    return 0;
+  if(level == 1){
+    // copy just the page written to.
+    if(uvmsplit(pagetable, va) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  pa = PTE2PA(*pte);
+
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(p && pagetable == p->pagetable)
+    p->nfault++;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    uvmflushpage(pagetable, va);
+    return pa;
+  }
+  old = *pte;
+  if((mem = kalloc_user(0)) == 0)
+    return 0;
+  if(*pte != old){
+    // kalloc_user() slept, and the page was swapped out.
+    kfree(mem);
+    return vmfault(pagetable, va, write);
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  uvmflushpage(pagetable, va);
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
+// Fault in the user pages of [va, va+len) that are not
+// there, or, if write, not writable, so that copying to or
+// from them won't fault. Returns 0, or -1 if some page of
+// the range can't be read, or written if write.
+int
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  uint64 a;
+  pte_t *pte;
+  int level;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkleaf(pagetable, a, 0, &level);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+      if(vmfault(pagetable, a, write) == 0)
+        return -1;
+    } else if((*pte & (PTE_U|PTE_R)) != (PTE_U|PTE_R)){
+      return -1;
+    }
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// the page is left execute-only, not just without
+// PTE_U: copyuser() reaches user memory with supervisor
+// loads and stores, which may use non-PTE_U pages.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -349,7 +924,45 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+  uvmflush(pagetable);
+}
+
+// Can the kernel reach user addresses [va, va+len), len > 0,
+// of the current process p through its kernel page table?
+// Only if no kernel mapping shares their root slots; the
+// user page table may have filled in a slot since the
+// kernel page table was made, so copy it over.
+static int
+kvmvisible(struct proc *p, uint64 va, uint64 len)
+{
+  if(va + len < va || va + len > MAXVA)
+    return 0;
+  for(int i = PX(2, va); i <= PX(2, va + len - 1); i++){
+    if(kernel_pagetable[i] & PTE_V)
+      return 0;
+    if(p->kpagetable[i] != p->pagetable[i]){
+      p->kpagetable[i] = p->pagetable[i];
+      kvmflush(p);
+    }
+  }
+  return 1;
+}
+
+// A load or store in copyuser() or copyinstruser() faulted
+// on user address va: fill in the page, or break
+// copy-on-write sharing, as for a fault from user space.
+// Returns 0 if the copy can go on, -1 if it must fail.
+int
+kvmfault(uint64 va, int write)
+{
+  struct proc *p = myproc();
+
+  if(vmfault(p->pagetable, va, write) == 0)
+    return -1;
+  // the fault may have added a level-1 page-table page.
+  kvmvisible(p, PGROUNDDOWN(va), PGSIZE);
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -358,18 +971,34 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
   pte_t *pte;
+  int level;
 
+  if(len > 0 && p && pagetable == p->pagetable && kvmvisible(p, dstva, len)){
+    __sync_fetch_and_add(&copystats.direct, 1);
+    return copyuser((char*)dstva, src, len);
+  }
+  __sync_fetch_and_add(&copystats.walked, 1);
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     if(va0 >= MAXVA)
       return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
-      return -1;
-    pa0 = PTE2PA(*pte);
+    pte = walkleaf(pagetable, va0, 0, &level);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0 ||
+       (*pte & PTE_U) == 0){
+      // fault the page in, or break copy-on-write sharing,
+      // as a store from user space would.
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0)
+        return -1;
+    } else {
+      pa0 = PTE2PA(*pte) + (va0 & (level ? MEGAPGSIZE-1 : 0));
+    }
+    // the kernel writes through its own mapping of pa0,
+    // so mark the page dirty for vmaunmap()'s write-back.
+    if((pte = walk(pagetable, va0, 0)) != 0)
+      *pte |= PTE_D;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -388,12 +1017,18 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
 
+  if(len > 0 && p && pagetable == p->pagetable && kvmvisible(p, srcva, len)){
+    __sync_fetch_and_add(&copystats.direct, 1);
+    return copyuser(dst, (char*)srcva, len);
+  }
+  __sync_fetch_and_add(&copystats.walked, 1);
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -414,13 +1049,20 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(max > 0 && p && pagetable == p->pagetable && kvmvisible(p, srcva, max)){
+    __sync_fetch_and_add(&copystats.direct, 1);
+    return copyinstruser(dst, (char*)srcva, max);
+  }
+  __sync_fetch_and_add(&copystats.walked, 1);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -449,3 +1091,42 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     return -1;
   }
 }
+
+// Count the page-table pages reachable from pagetable, a
+// level-level page-table page, and the leaf PTEs at each level.
+static void
+vmcount(pagetable_t pagetable, int level, uint64 *ptpages, uint64 *leaves)
+{
+  (*ptpages)++;
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) == 0)
+      continue;
+    if(PTE_LEAF(pte))
+      leaves[level]++;
+    else
+      vmcount((pagetable_t)PTE2PA(pte), level-1, ptpages, leaves);
+  }
+}
+
+// Report the shape of the kernel page table, how much user
+// memory is in megapages, how often the TLB has been
+// flushed for ASIDs, and how user memory was copied, for
+// the statistics device.
+int
+statsvm(char *buf, int sz)
+{
+  uint64 ptpages = 0, leaves[3] = { 0, 0, 0 };
+  int n;
+
+  vmcount(kernel_pagetable, 2, &ptpages, leaves);
+  n = snprintf(buf, sz, "kvm: ptpages %ld pages %ld megapages %ld\n",
+               ptpages, leaves[0], leaves[1]);
+  n += snprintf(buf+n, sz-n, "uvm: megapages %ld collapse %ld split %ld nomem %ld\n",
+                megastats.mapped, megastats.collapse, megastats.split, megastats.nomem);
+  n += snprintf(buf+n, sz-n, "asid: max %d gen %ld flush %ld fullflush %ld\n",
+                asids.max, asids.gen, asids.nflush, asids.nfull);
+  n += snprintf(buf+n, sz-n, "copy: direct %ld walked %ld\n",
+                copystats.direct, copystats.walked);
+  return n;
+}
@@ -0,0 +1,401 @@
+// Virtual memory areas: ranges of a process's address
+// space whose pages are filled in on first touch, rather
+// than when the range is set up.
+//
+// exec() describes each loadable program segment with a
+// VMA instead of reading it in, and mmap() adds a VMA for
+// each mapping; vmfault() calls vmapage() when the process
+// first touches one of their pages. Program segments lie
+// below p->sz and their pages are freed along with the
+// rest of the image; mmap()ed areas (VMA_MMAP) lie above
+// p->sz and are unmapped by vmaunmap().
+//
+// The pages of a MAP_SHARED area are kept in a struct shm
+// as well as in page tables, so that fork() need not fill
+// them all in: parent and child share the shm, and whichever
+// first touches a page puts it there for the other to find.
+// The shm is indexed by v->off plus the offset in the area,
+// and holds a reference to each of its pages until the last
+// area using it goes away.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "proc.h"
+#include "slab.h"
+#include "defs.h"
+
+struct shm {
+  struct sleeplock lock;       // held while looking up or filling in a page
+  int ref;                     // VMAs using it
+  pagetable_t pages;           // page at each offset, indexed like a page table
+};
+
+static struct kmem_cache shmcache;
+
+void
+vmainit(void)
+{
+  kmem_cache_init(&shmcache, "shm", sizeof(struct shm));
+}
+
+// Find the VMA of process p that contains va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Does any of p's VMAs overlap [start, end)?
+int
+vmaoverlap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags && v->start < end && start < v->end)
+      return 1;
+  return 0;
+}
+
+// Read in a page of VMA v, for vmapage().
+static void*
+vmafill(struct vma *v, uint64 va)
+{
+  uint64 off = va - v->start;
+  uint n = 0;
+  int locked, r = 0, shared;
+  char *mem = 0;
+
+  if(v->ip && off < v->filesz)
+    n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+  if(n == 0)
+    return kalloc_zeroed();
+  shared = n == PGSIZE && (v->perm & PTE_W) == 0;
+
+  // a write() whose source buffer lies in this very file
+  // faults here with the inode already locked. with some
+  // other inode locked, waiting for this one could deadlock
+  // against a process copying the other way; fail instead.
+  // fileread() and filewrite() fault their buffers in
+  // before they lock, so this only happens if a page was
+  // swapped out again in between.
+  locked = holdingsleep(&v->ip->lock);
+  if(!locked && iholding())
+    return 0;
+  if(!locked)
+    ilock(v->ip);
+  if(shared)
+    mem = textget(v->ip, v->off + off);
+  if(mem == 0 && (mem = kalloc()) != 0){
+    r = readi(v->ip, 0, (uint64)mem, v->off + off, n);
+    if(r < 0 || (r != n && (v->flags & VMA_MMAP) == 0)){
+      kfree(mem);
+      mem = 0;
+    } else if(shared && r == PGSIZE){
+      textput(v->ip, v->off + off, mem);
+    } else {
+      memset(mem + r, 0, PGSIZE - r);
+    }
+  }
+  if(!locked)
+    iunlock(v->ip);
+  return mem;
+}
+
+// Return a page holding VMA v's contents at page-aligned
+// address va: file data up to v->filesz, zeroes after that.
+// Pages of read-only segments that are all file data come
+// from the shared text cache (textcache.c), and those of
+// MAP_SHARED areas from v's shm if some process sharing it
+// has touched them. May sleep reading the file. Returns 0
+// if out of memory or if a program file is too short; a
+// mapping may extend past the end of its file, and reads
+// as zeroes there.
+void*
+vmapage(struct vma *v, uint64 va)
+{
+  struct shm *s = v->shm;
+  pte_t *pte;
+  void *mem;
+
+  if(s == 0)
+    return vmafill(v, va);
+
+  // whoever holds s->lock may be waiting for v->ip's lock
+  // in vmafill(); see the comment there.
+  if(v->ip && iholding())
+    return 0;
+  acquiresleep(&s->lock);
+  if((pte = walk(s->pages, v->off + (va - v->start), 1)) == 0){
+    mem = 0;
+  } else if(*pte & PTE_V){
+    mem = (void*)PTE2PA(*pte);
+    krefinc(mem);
+  } else if((mem = vmafill(v, va)) != 0){
+    krefinc(mem);
+    *pte = PA2PTE(mem) | PTE_V | PTE_R;
+  }
+  releasesleep(&s->lock);
+  return mem;
+}
+
+// Free the page-table pages of a shm's index, and drop its
+// references to the pages in it.
+static void
+shmfreewalk(pagetable_t pt, int level)
+{
+  for(int i = 0; i < 512; i++){
+    if((pt[i] & PTE_V) == 0)
+      continue;
+    if(level > 0)
+      shmfreewalk((pagetable_t)PTE2PA(pt[i]), level - 1);
+    else
+      kfree((void*)PTE2PA(pt[i]));
+  }
+  kfree(pt);
+}
+
+static void
+shmput(struct shm *s)
+{
+  if(__sync_sub_and_fetch(&s->ref, 1) == 0){
+    shmfreewalk(s->pages, 2);
+    kmem_cache_free(&shmcache, s);
+  }
+}
+
+// Give np copies of all of p's VMAs, for fork(). The pages
+// of mmap()ed areas are copied here too, since uvmcopy()
+// only copies p's memory below p->sz: private ones become
+// copy-on-write, shared ones are shared outright.
+// Returns 0 on success, -1 on failure.
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if((v->flags & VMA_MMAP) == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->start, v->end,
+                    v->flags & MAP_SHARED) < 0){
+      for(v = p->vma; v < &p->vma[NVMA]; v++)
+        if(v->flags & VMA_MMAP)
+          uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+      return -1;
+    }
+  }
+  for(int i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(p->vma[i].ip)
+      idup(p->vma[i].ip);
+    if(p->vma[i].shm)
+      __sync_fetch_and_add(&p->vma[i].shm->ref, 1);
+  }
+  return 0;
+}
+
+// Drop VMA v and its file and shm references.
+// Must be called inside a transaction, since it calls iput().
+void
+vmaclose(struct vma *v)
+{
+  if(v->ip)
+    iput(v->ip);
+  if(v->shm)
+    shmput(v->shm);
+  memset(v, 0, sizeof(*v));
+}
+
+// The process is shrinking from p->sz to sz bytes: program
+// segments must not reach past sz, or re-growing the heap
+// would read file data back in where zeroes belong.
+void
+vmatrunc(struct proc *p, uint64 sz)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags == 0 || (v->flags & VMA_MMAP) || v->end <= sz)
+      continue;
+    v->end = v->start < sz ? sz : v->start;
+  }
+}
+
+// Write the dirty pages of shared file mapping v in
+// [start, end) back to the file, one transaction per page.
+// Only data within the file's current size is written;
+// a mapping never makes its file grow.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a, off;
+  pte_t *pte;
+  uint n;
+
+  if(v->ip == 0 || (v->flags & MAP_SHARED) == 0 || (v->perm & PTE_W) == 0)
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (a - v->start);
+    begin_op();
+    ilock(v->ip);
+    if(off < v->ip->size){
+      n = v->ip->size - off < PGSIZE ? v->ip->size - off : PGSIZE;
+      writei(v->ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(v->ip);
+    end_op();
+  }
+}
+
+// Move the start of VMA v up to a, keeping the rest of
+// it backed by the same part of its file.
+static void
+vmaskip(struct vma *v, uint64 a)
+{
+  uint64 d = a - v->start;
+
+  v->start = a;
+  v->off += d;
+  v->filesz = v->filesz > d ? v->filesz - d : 0;
+}
+
+// Remove [start, end) from p's VMAs, writing dirty shared
+// pages back to their files and freeing the pages of
+// mmap()ed areas. Unmapping the middle of a VMA splits it.
+// Returns 0 on success, -1 if a split needs a free VMA
+// slot and there is none, in which case nothing changes.
+int
+vmaunmap(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v, *nv = 0;
+  uint64 a, b;
+
+  // only a VMA reaching past both ends of the range can
+  // need splitting, so at most one.
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags && v->start < start && end < v->end){
+      for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+        if(nv->flags == 0)
+          break;
+      if(nv == &p->vma[NVMA])
+        return -1;
+    }
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags == 0 || v->end <= start || end <= v->start)
+      continue;
+    a = v->start > start ? v->start : start;
+    b = v->end < end ? v->end : end;
+
+    vmawriteback(p, v, a, b);
+    if(v->flags & VMA_MMAP)
+      uvmunmap(p->pagetable, a, (b - a) / PGSIZE, 1);
+
+    if(v->start < a && b < v->end){
+      // keep [v->start, a) in v and [b, v->end) in nv.
+      *nv = *v;
+      if(nv->ip)
+        idup(nv->ip);
+      if(nv->shm)
+        __sync_fetch_and_add(&nv->shm->ref, 1);
+      vmaskip(nv, b);
+      v->end = a;
+    } else if(a == v->start && b == v->end){
+      begin_op();
+      vmaclose(v);
+      end_op();
+    } else if(a == v->start){
+      vmaskip(v, b);
+    } else {
+      v->end = a;
+    }
+  }
+  return 0;
+}
+
+// Map len bytes of file ip (0 for anonymous memory) at
+// offset off into p's address space, below the trapframe
+// and above any earlier mappings. prot is PROT_* and
+// flags is MAP_*; the caller has checked them against
+// the file. Pages are filled in on first touch.
+// Returns the address of the mapping, or -1.
+uint64
+vmammap(struct proc *p, uint64 len, int prot, int flags, struct inode *ip, uint64 off)
+{
+  struct vma *v, *u;
+  uint64 a;
+  int moved;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > TRAPFRAME)
+    return -1;
+  // a shm is indexed by offset with walk(), which stops at
+  // MAXVA; and file offsets are uints, for readi().
+  if(off + len < off || off + len > (ip ? (1L << 32) : MAXVA))
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  // top-down: just below the lowest mapping in the way.
+  a = TRAPFRAME - len;
+  do {
+    moved = 0;
+    for(u = p->vma; u < &p->vma[NVMA]; u++){
+      if(u->flags && u->start < a + len && a < u->end){
+        if(u->start < len)
+          return -1;
+        a = u->start - len;
+        moved = 1;
+      }
+    }
+  } while(moved);
+  if(a < PGROUNDUP(p->sz))
+    return -1;
+
+  v->start = a;
+  v->end = a + len;
+  v->perm = PTE_U;
+  if(prot & PROT_READ)
+    v->perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    v->perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    v->perm |= PTE_X;
+  if(flags & MAP_SHARED){
+    if((v->shm = kmem_cache_alloc(&shmcache)) == 0)
+      return -1;
+    if((v->shm->pages = kalloc_zeroed()) == 0){
+      kmem_cache_free(&shmcache, v->shm);
+      v->shm = 0;
+      return -1;
+    }
+    initsleeplock(&v->shm->lock, "shm");
+    v->shm->ref = 1;
+  }
+  v->flags = (flags & (MAP_SHARED|MAP_PRIVATE)) | VMA_MMAP;
+  v->ip = ip ? idup(ip) : 0;
+  v->off = off;
+  v->filesz = ip ? len : 0;
+  return a;
+}
@@ -0,0 +1,73 @@
+//
+// exec latency benchmark: time fork()+exec()+exit()+wait()
+// for a small and a large program, and fork()+exit()+wait()
+// alone for comparison.
+//
+// usage: execbench [iterations]
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+struct prog {
+  char *name;
+  char *argv[3];
+};
+
+// both exit right away: echo prints to a closed file
+// descriptor, and usertests rejects its argument.
+struct prog progs[] = {
+  { "echo", { "echo", "x", 0 } },
+  { "usertests", { "usertests", "-x", 0 } },
+};
+
+// run n children that each exec p (or just exit, if p is 0),
+// one at a time, and return the elapsed microseconds.
+int
+run(struct prog *p, int n)
+{
+  uint64 t0;
+  int pid;
+
+  t0 = usecs();
+  for(int i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      if(p){
+        close(1);
+        close(2);
+        exec(p->name, p->argv);
+      }
+      exit(0);
+    }
+    wait(0);
+  }
+  return usecs() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 200;
+  int base, t;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    printf("usage: execbench [iterations]\n");
+    exit(1);
+  }
+
+  base = run(0, n);
+  printf("execbench: fork+exit: %d iterations in %dus\n", n, base);
+  for(int i = 0; i < sizeof(progs)/sizeof(progs[0]); i++){
+    t = run(&progs[i], n);
+    printf("execbench: exec %s: %d iterations in %dus (%dus over fork+exit)\n",
+           progs[i].name, n, t, t - base);
+  }
+  exit(0);
+}
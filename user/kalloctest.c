@@ -0,0 +1,125 @@
+// Exercise the per-CPU page allocator: several processes
+// allocate and free memory at once, then check the
+// statistics device for local hits, steals, and leaks.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NPAGES 64
+#define N      200
+#define SLACK  32    // free pages test2 lets caches keep
+
+// pages on the per-CPU lists, zeroed or not, and in the
+// buddy allocator.
+uint64
+freepages(void)
+{
+  return statlines("kmem ", "free ") + statlines("kmem ", "zeroed ") +
+         statlines("buddy: ", "free ");
+}
+
+void
+churn(void)
+{
+  char *a;
+  int i, j;
+
+  for(i = 0; i < N; i++){
+    a = sbrk(NPAGES*PGSIZE);
+    if(a == (char*)-1){
+      printf("kalloctest: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < NPAGES; j++)
+      a[j*PGSIZE] = j;
+    if(sbrk(-NPAGES*PGSIZE) == (char*)-1){
+      printf("kalloctest: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+}
+
+// All CPUs allocate at once; most allocations should
+// be satisfied from the allocating CPU's own list.
+void
+test1(void)
+{
+  uint64 hit0, steal0, hit, steal;
+  int i, pid;
+
+  printf("start test1\n");
+  hit0 = statlines("kmem ", "hit ");
+  steal0 = statlines("kmem ", "steal ");
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      churn();
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+
+  statprint("");
+  hit = statlines("kmem ", "hit ") - hit0;
+  steal = statlines("kmem ", "steal ") - steal0;
+  printf("local hits %d, steals %d\n", (int)hit, (int)steal);
+  if(hit < steal){
+    printf("test1 FAIL: more steals than local hits\n");
+    exit(1);
+  }
+  printf("test1 OK\n");
+}
+
+// Once every child has exited, every page must be back
+// on some CPU's free list, or in the buddy allocator,
+// except for a few that the text cache or a slab may
+// have kept. A child that leaked its last sbrk() would
+// lose NPAGES.
+void
+test2(void)
+{
+  uint64 free0, free1;
+  int i, pid;
+
+  printf("start test2\n");
+  free0 = freepages();
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      churn();
+      sbrk(NPAGES*PGSIZE);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+
+  free1 = freepages();
+  if(free1 + SLACK < free0){
+    printf("test2 FAIL: %d free pages before, %d after\n", (int)free0, (int)free1);
+    exit(1);
+  }
+  printf("test2 OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test1();
+  test2();
+  exit(0);
+}
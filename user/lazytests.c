@@ -0,0 +1,326 @@
+//
+// tests for lazy (demand-zero) sbrk.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define REGION_SZ (1024 * 1024 * 1024)
+
+// page faults taken by this process so far, according
+// to its "proc <pid> <name>: faults <n>" line in the
+// statistics device.
+uint64
+myfaults(void)
+{
+  char key[16];
+  int pid, n;
+
+  pid = getpid();
+  n = sizeof(key) - 1;
+  key[n--] = 0;
+  key[n--] = ' ';
+  do {
+    key[n--] = '0' + pid % 10;
+    pid /= 10;
+  } while(pid);
+  n -= 4;
+  memmove(key + n, "proc ", 5);
+
+  return statlines(key + n, "faults ");
+}
+
+// a counter from the "uvm: ..." line of the statistics device.
+uint64
+uvmstat(char *key)
+{
+  return statlines("uvm: ", key);
+}
+
+// a huge sbrk should succeed immediately, and only the
+// pages actually touched should cost memory and faults.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+  uint64 f0, f1;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  myfaults(); // take statlines()' own faults before counting.
+  f0 = myfaults();
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE)
+    *(char **)i = i;
+  f1 = myfaults();
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char **)i != i){
+      printf("%s: failed to read value from memory\n", s);
+      exit(1);
+    }
+  }
+
+  if(f1 - f0 != REGION_SZ / (64 * PGSIZE)){
+    printf("%s: expected %d faults, got %d\n", s,
+           REGION_SZ / (64 * PGSIZE), (int)(f1 - f0));
+    exit(1);
+  }
+  exit(0);
+}
+
+// shrinking with sbrk() must unmap the lazily allocated
+// pages, even those that were never touched.
+void
+sparse_memory_unmap(char *s)
+{
+  int pid;
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: error forking\n", s);
+      exit(1);
+    } else if(pid == 0){
+      sbrk(-1L * REGION_SZ);
+      *(char **)i = i;
+      exit(0);
+    } else {
+      int status;
+      wait(&status);
+      if(status == 0){
+        printf("%s: memory not unmapped\n", s);
+        exit(1);
+      }
+    }
+  }
+  exit(0);
+}
+
+// system calls must fault in untouched heap pages
+// rather than fail.
+void
+syscall_lazy(char *s)
+{
+  char *a;
+  int fd;
+
+  a = sbrk(4 * PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  // copyout() into never-touched pages.
+  if(read(fd, a + PGSIZE - 8, 2 * PGSIZE) <= 8){
+    printf("%s: read into lazy pages failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // copyin() from never-touched pages.
+  fd = open("lazytests.tmp", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: open lazytests.tmp failed\n", s);
+    exit(1);
+  }
+  if(write(fd, a + 3 * PGSIZE, PGSIZE) != PGSIZE){
+    printf("%s: write from lazy page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lazytests.tmp");
+  exit(0);
+}
+
+// the child of a fork must see the parent's lazily
+// allocated pages, touched or not.
+void
+fork_lazy(char *s)
+{
+  char *a;
+  int pid, status;
+
+  a = sbrk(8 * PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  a[0] = 'x';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[0] != 'x' || a[5 * PGSIZE] != 0)
+      exit(1);
+    a[5 * PGSIZE] = 'y';
+    exit(0);
+  }
+  wait(&status);
+  if(status != 0){
+    printf("%s: child saw wrong contents\n", s);
+    exit(1);
+  }
+  if(a[5 * PGSIZE] != 0){
+    printf("%s: child wrote parent's page\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// densely touching a large heap should get it mapped with
+// megapages, which must keep their contents, survive fork
+// with copy-on-write, and split when sbrk() shrinks into one.
+void
+megapage_heap(char *s)
+{
+  uint64 sz = 8 * 1024 * 1024;
+  uint64 c0, c1, s0;
+  char *a, *p;
+  int pid, status;
+
+  a = sbrk(0);
+  a = sbrk(sz + (MEGAPGROUNDUP((uint64)a) - (uint64)a));
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  a = (char*)MEGAPGROUNDUP((uint64)a);
+
+  c0 = uvmstat("collapse ");
+  for(p = a; p < a + sz; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+  c1 = uvmstat("collapse ");
+  if(c1 - c0 < sz / MEGAPGSIZE){
+    printf("%s: %d collapses, expected %d\n", s, (int)(c1 - c0), (int)(sz / MEGAPGSIZE));
+    exit(1);
+  }
+  for(p = a; p < a + sz; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong contents at %p\n", s, p);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + sz; p += 64 * PGSIZE)
+      *(uint64*)p = 0;
+    exit(0);
+  }
+  wait(&status);
+  if(status != 0)
+    exit(1);
+  for(p = a; p < a + sz; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: child wrote parent's megapage\n", s);
+      exit(1);
+    }
+  }
+
+  s0 = uvmstat("split ");
+  if(sbrk(-(MEGAPGSIZE / 2)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk() shrink failed\n", s);
+    exit(1);
+  }
+  if(uvmstat("split ") == s0){
+    printf("%s: shrink did not split a megapage\n", s);
+    exit(1);
+  }
+  for(p = a + sz - MEGAPGSIZE; p < a + sz - MEGAPGSIZE / 2; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong contents after split\n", s);
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+// run each test in its own process and report its exit status.
+int
+run(void f(char *), char *s)
+{
+  int pid;
+  int xstatus;
+
+  printf("running test %s\n", s);
+  if((pid = fork()) < 0){
+    printf("runtest: fork error\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("test %s: FAILED\n", s);
+    else
+      printf("test %s: OK\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *n = 0;
+  if(argc > 1)
+    n = argv[1];
+
+  struct test {
+    void (*f)(char *);
+    char *s;
+  } tests[] = {
+    { sparse_memory, "lazy alloc"},
+    { sparse_memory_unmap, "lazy unmap"},
+    { syscall_lazy, "lazy syscall"},
+    { fork_lazy, "lazy fork"},
+    { megapage_heap, "megapage heap"},
+    { 0, 0},
+  };
+
+  printf("lazytests starting\n");
+
+  int fail = 0;
+  for(struct test *t = tests; t->s != 0; t++){
+    if((n == 0) || strcmp(t->s, n) == 0){
+      if(!run(t->f, t->s))
+        fail = 1;
+    }
+  }
+  if(!fail)
+    printf("ALL TESTS PASSED\n");
+  else
+    printf("SOME TESTS FAILED\n");
+  exit(fail);
+}
@@ -0,0 +1,269 @@
+//
+// tests for mmap() and munmap().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char*)-1)
+
+char buf[PGSIZE];
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// make a file of 2.5 pages in which byte i is 'A' + i%23.
+void
+makefile(char *f)
+{
+  int fd, n;
+
+  unlink(f);
+  if((fd = open(f, O_WRONLY|O_CREATE)) < 0)
+    err("open");
+  for(int i = 0; i < PGSIZE + PGSIZE/2 + PGSIZE; i += n){
+    n = sizeof(buf);
+    if(n > PGSIZE + PGSIZE/2 + PGSIZE - i)
+      n = PGSIZE + PGSIZE/2 + PGSIZE - i;
+    for(int j = 0; j < n; j++)
+      buf[j] = 'A' + (i + j) % 23;
+    if(write(fd, buf, n) != n)
+      err("write");
+  }
+  close(fd);
+}
+
+// check that p holds the file's contents from offset off,
+// for len bytes, with zeroes past the end of the file.
+void
+checkfile(char *p, int off, int len)
+{
+  for(int i = 0; i < len; i++){
+    int o = off + i;
+    char want = o < 2*PGSIZE + PGSIZE/2 ? 'A' + o % 23 : 0;
+    if(p[i] != want)
+      err("wrong contents");
+  }
+}
+
+void
+privatetest(void)
+{
+  int fd;
+  char *p;
+
+  testname = "private";
+  printf("%s: ", testname);
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  checkfile(p, 0, 3*PGSIZE);
+
+  // writes stay private.
+  p[0] = 'z';
+  p[PGSIZE] = 'z';
+  if(munmap(p, 3*PGSIZE) != 0)
+    err("munmap");
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0 || read(fd, buf, 1) != 1 || buf[0] != 'A')
+    err("private write reached the file");
+  close(fd);
+
+  // a read-only file can't get a writable shared mapping.
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    err("mmap of read-only file allowed writes");
+  close(fd);
+  printf("ok\n");
+}
+
+void
+sharedtest(void)
+{
+  int fd;
+  char *p;
+
+  testname = "shared";
+  printf("%s: ", testname);
+  makefile("mmap.tmp");
+  if((fd = open("mmap.tmp", O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+
+  // unmap the middle page: the mapping splits in two.
+  p[0] = 'x';
+  p[PGSIZE] = 'y';
+  p[2*PGSIZE] = 'z';
+  if(munmap(p + PGSIZE, PGSIZE) != 0)
+    err("munmap middle");
+  if(p[0] != 'x' || p[2*PGSIZE] != 'z')
+    err("lost contents after split");
+  if(munmap(p, PGSIZE) != 0 || munmap(p + 2*PGSIZE, PGSIZE) != 0)
+    err("munmap");
+
+  // the changes, and nothing past the end of the file,
+  // were written back.
+  struct stat st;
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    err("open");
+  if(st.size != 2*PGSIZE + PGSIZE/2)
+    err("file size changed");
+  for(int i = 0; i < 3; i++){
+    if(read(fd, buf, PGSIZE) <= 0 || buf[0] != "xyz"[i])
+      err("changes not written back");
+  }
+  close(fd);
+  printf("ok\n");
+}
+
+// a process that exits without munmap() still writes its
+// shared pages back.
+void
+exittest(void)
+{
+  int fd, pid, xstatus;
+  char *p;
+
+  testname = "exit";
+  printf("%s: ", testname);
+  makefile("mmap.tmp");
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if((fd = open("mmap.tmp", O_RDWR)) < 0)
+      exit(1);
+    p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+      exit(1);
+    p[1] = '!';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child failed");
+  if((fd = open("mmap.tmp", O_RDONLY)) < 0 || read(fd, buf, 2) != 2)
+    err("open");
+  if(buf[1] != '!')
+    err("not written back on exit");
+  close(fd);
+  unlink("mmap.tmp");
+  printf("ok\n");
+}
+
+// anonymous memory: private copies after fork stay apart,
+// shared ones don't, and unmapped memory is gone.
+void
+anontest(void)
+{
+  int pid, xstatus;
+  char *priv, *shared;
+
+  testname = "anon";
+  printf("%s: ", testname);
+  priv = mmap(0, 16*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  shared = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(priv == MAP_FAILED || shared == MAP_FAILED)
+    err("mmap");
+  for(int i = 0; i < 16*PGSIZE; i += PGSIZE)
+    if(priv[i] != 0)
+      err("not zero");
+  priv[0] = 1;
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(priv[0] != 1)
+      exit(1);
+    priv[0] = 2;
+    shared[PGSIZE] = 3;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child saw wrong contents");
+  if(priv[0] != 1)
+    err("child wrote private memory");
+  if(shared[PGSIZE] != 3)
+    err("child's write to shared memory not seen");
+
+  if(munmap(priv, 16*PGSIZE) != 0 || munmap(shared, 2*PGSIZE) != 0)
+    err("munmap");
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    priv[0] = 1; // should be killed.
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus == 0)
+    err("unmapped memory still accessible");
+  printf("ok\n");
+}
+
+// a shared mapping bigger than memory: fork() must not
+// fill it in, and pages either side first touches after
+// the fork are still shared.
+void
+bigsharedtest(void)
+{
+  int pid, xstatus;
+  uint64 len = 256*1024*1024;
+  char *p;
+
+  testname = "bigshared";
+  printf("%s: ", testname);
+  p = mmap(0, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  p[0] = 1;
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(p[0] != 1)
+      exit(1);
+    p[len/2] = 2;
+    while(p[len - PGSIZE] != 3)
+      sleep(1);
+    exit(0);
+  }
+  p[len - PGSIZE] = 3;
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child saw wrong contents");
+  if(p[len/2] != 2)
+    err("child's write to shared memory not seen");
+  if(munmap(p, len) != 0)
+    err("munmap");
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  privatetest();
+  sharedtest();
+  exittest();
+  anontest();
+  bigsharedtest();
+  printf("ALL MMAP TESTS PASSED\n");
+  exit(0);
+}
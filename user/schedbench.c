@@ -0,0 +1,377 @@
+//
+// scheduler benchmarks.
+//
+// usage: schedbench switch|spin|latency|fair|idle|sleep [nproc]
+//
+// switch: nproc/2 pairs of processes bounce a byte back
+// and forth over pipes, so that nearly all of their time
+// goes to sleeping, waking, and choosing what to run next.
+// reports round trips per second, and the scheduler's own
+// counters, including the average time a CPU takes to
+// choose a process (pickns).
+//
+// spin: nproc processes each count for a few seconds
+// without making system calls. reports the total count,
+// which should grow with the number of harts until there
+// are more harts than processes.
+//
+// latency: while nproc processes compute, an interactive
+// pair of processes, which mostly sleep, bounce a byte
+// over pipes every tick. reports how long each round trip
+// took; with a feedback queue the pair stays at the top
+// level, so this should be much less than a time slice.
+//
+// fair: nproc processes join the fair-share class with
+// weights of 1, 2 and 4 times the ordinary share, and
+// count for a few seconds. reports each one's share of
+// the total count next to its share of the total weight;
+// with more processes than harts, they should be close.
+//
+// idle: nproc processes count for a few seconds, and each
+// hart reports how much of that time it spent idle, in
+// wfi. with fewer processes than harts, the rest should
+// be idle nearly all the time.
+//
+// sleep: sleeps of 1, 2 and 5 ticks, while nproc processes
+// compute; then nothing at all for a second. reports how
+// long each sleep took against the length asked for, and
+// how many timer interrupts the harts took meanwhile: a
+// hart running one process alone, or idle, should take
+// next to none. timerns in the scheduler's counters is how
+// late timer interrupts reach the kernel: compare make
+// SSTC=1 qemu, which programs stimecmp directly, with
+// SSTC=0, where each goes through machine mode first.
+//
+// to see how switch, spin and fair scale, boot with make CPUS=1
+// qemu, CPUS=2, and so on up to 8.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define PINGS    10000           // round trips per pair
+#define SPINUS   3000000         // microseconds each spinner runs
+#define NLAT     50              // latency round trips
+#define NICE0    1024            // an ordinary weight
+#define NSLEEP   10              // sleeps of each length
+
+// the number after key on hart cpu's "sched" line of the
+// statistics device, or -1 if there is no such hart.
+long
+cpustat(int cpu, char *key)
+{
+  char prefix[16];
+
+  strcpy(prefix, "sched cpu0:");
+  prefix[9] = '0' + cpu;
+  return statlines(prefix, key);
+}
+
+// one side of a ping-pong pair: PINGS times, send a byte
+// on out and wait for one on in; or, if not first, the
+// other way around.
+void
+pinger(int in, int out, int first)
+{
+  char c = 0;
+
+  for(int i = 0; i < PINGS; i++){
+    if((first && write(out, &c, 1) != 1) || read(in, &c, 1) != 1 ||
+       (!first && write(out, &c, 1) != 1)){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+void
+switchbench(int nproc)
+{
+  int ab[2], ba[2], npair = nproc / 2;
+  uint64 t0, t1;
+
+  if(npair < 1)
+    npair = 1;
+  t0 = usecs();
+  for(int i = 0; i < npair; i++){
+    if(pipe(ab) < 0 || pipe(ba) < 0){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+    if(fork() == 0)
+      pinger(ba[0], ab[1], 1);
+    if(fork() == 0)
+      pinger(ab[0], ba[1], 0);
+    close(ab[0]);
+    close(ab[1]);
+    close(ba[0]);
+    close(ba[1]);
+  }
+  for(int i = 0; i < 2*npair; i++)
+    wait(0);
+  t1 = usecs();
+
+  printf("switch: %d pairs, %d round trips each, in %dus: %d round trips/s\n",
+         npair, PINGS, (int)(t1 - t0),
+         (int)((uint64)npair * PINGS * 1000000 / (t1 - t0 + 1)));
+  statprint("sched ");
+}
+
+// count until SPINUS have passed since start, and report
+// id and the count through the pipe.
+void
+spinner(int id, uint64 start, int out)
+{
+  uint64 msg[2] = { id, 0 };
+
+  while(usecs() < start + SPINUS){
+    for(volatile int i = 0; i < 10000; i++)
+      ;
+    msg[1]++;
+  }
+  write(out, msg, sizeof(msg));
+  exit(0);
+}
+
+// collect the counts of nproc spinners into n[], and
+// return their total.
+uint64
+collect(int in, int nproc, uint64 *n)
+{
+  uint64 msg[2], total = 0;
+
+  for(int i = 0; i < nproc; i++){
+    if(read(in, msg, sizeof(msg)) != sizeof(msg) || msg[0] >= nproc){
+      printf("schedbench: read failed\n");
+      exit(1);
+    }
+    n[msg[0]] = msg[1];
+    total += msg[1];
+  }
+  close(in);
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+  return total;
+}
+
+void
+spinbench(int nproc)
+{
+  int fds[2];
+  uint64 n[32], total, start = usecs();
+
+  if(pipe(fds) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < nproc; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      spinner(i, start, fds[1]);
+    }
+  }
+  close(fds[1]);
+  total = collect(fds[0], nproc, n);
+
+  printf("spin: %d processes, %d loops in %dus\n", nproc, (int)total, SPINUS);
+  statprint("sched ");
+}
+
+void
+latencybench(int nproc)
+{
+  int pids[32], ab[2], ba[2];
+  uint64 t, total = 0, worst = 0;
+  char c = 0;
+
+  for(int i = 0; i < nproc; i++){
+    if((pids[i] = fork()) == 0){
+      for(;;)
+        ;
+    }
+  }
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    while(read(ab[0], &c, 1) == 1)
+      write(ba[1], &c, 1);
+    exit(0);
+  }
+  close(ab[0]);
+  close(ba[1]);
+
+  for(int i = 0; i < NLAT; i++){
+    sleep(1);
+    t = usecs();
+    if(write(ab[1], &c, 1) != 1 || read(ba[0], &c, 1) != 1){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+    t = usecs() - t;
+    total += t;
+    if(t > worst)
+      worst = t;
+  }
+  close(ab[1]);
+  close(ba[0]);
+  for(int i = 0; i < nproc; i++)
+    kill(pids[i]);
+  for(int i = 0; i < nproc + 1; i++)
+    wait(0);
+
+  printf("latency: %d spinners, %d round trips: average %dus worst %dus\n",
+         nproc, NLAT, (int)(total / NLAT), (int)worst);
+  statprint("sched ");
+}
+
+int
+weight(int i)
+{
+  return NICE0 << (i % 3);
+}
+
+void
+fairbench(int nproc)
+{
+  int fds[2];
+  uint64 n[32], total, wtotal = 0, start = usecs();
+
+  if(pipe(fds) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < nproc; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      if(setweight(weight(i)) < 0){
+        printf("schedbench: setweight failed\n");
+        exit(1);
+      }
+      spinner(i, start, fds[1]);
+    }
+    wtotal += weight(i);
+  }
+  close(fds[1]);
+  total = collect(fds[0], nproc, n);
+
+  printf("fair: %d processes, %d loops in %dus\n", nproc, (int)total, SPINUS);
+  for(int i = 0; i < nproc; i++)
+    printf("fair: weight %d: %d loops, share %d%% of %d%%\n", weight(i), (int)n[i],
+           (int)(n[i] * 100 / (total + 1)), (int)(weight(i) * 100 / wtotal));
+  statprint("sched ");
+}
+
+void
+idlebench(int nproc)
+{
+  int fds[2];
+  long idle0[8], idle;
+  uint64 n[32], start;
+
+  for(int i = 0; i < 8; i++)
+    idle0[i] = cpustat(i, "idlems ");
+  if(pipe(fds) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  start = usecs();
+  for(int i = 0; i < nproc; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      spinner(i, start, fds[1]);
+    }
+  }
+  close(fds[1]);
+  collect(fds[0], nproc, n);
+
+  printf("idle: %d processes for %dus\n", nproc, SPINUS);
+  for(int i = 0; i < 8 && idle0[i] >= 0; i++){
+    idle = cpustat(i, "idlems ") - idle0[i];
+    printf("idle: cpu%d idle %dms (%d%%)\n", i, (int)idle, (int)(idle * 100000 / SPINUS));
+  }
+}
+
+// the timer interrupts all harts have taken.
+long
+timers(void)
+{
+  return statlines("sched ", "timer ");
+}
+
+void
+sleepbench(int nproc)
+{
+  int pids[32], lens[] = { 1, 2, 5 };
+  uint64 t, total, worst;
+  long n0;
+
+  for(int i = 0; i < nproc; i++){
+    if((pids[i] = fork()) == 0){
+      for(;;)
+        ;
+    }
+  }
+  for(int j = 0; j < 3; j++){
+    total = worst = 0;
+    n0 = timers();
+    sleep(1);
+    for(int i = 0; i < NSLEEP; i++){
+      t = usecs();
+      sleep(lens[j]);
+      t = usecs() - t;
+      total += t;
+      if(t > worst)
+        worst = t;
+    }
+    printf("sleep: %d ticks (%dus) %d spinners: average %dus worst %dus, %d timer interrupts\n",
+           lens[j], lens[j] * TICKUS, nproc, (int)(total / NSLEEP), (int)worst,
+           (int)(timers() - n0));
+  }
+  for(int i = 0; i < nproc; i++)
+    kill(pids[i]);
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+
+  n0 = timers();
+  t = usecs();
+  sleep(1000000 / TICKUS);
+  printf("sleep: quiet for %dus: %d timer interrupts\n", (int)(usecs() - t), (int)(timers() - n0));
+  statprint("sched ");
+}
+
+void
+usage(void)
+{
+  printf("usage: schedbench switch|spin|latency|fair|idle|sleep [nproc]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 8;
+
+  if(argc == 3)
+    nproc = atoi(argv[2]);
+  if(argc < 2 || argc > 3 || nproc < 1 || nproc > 32)
+    usage();
+  if(strcmp(argv[1], "switch") == 0)
+    switchbench(nproc);
+  else if(strcmp(argv[1], "spin") == 0)
+    spinbench(nproc);
+  else if(strcmp(argv[1], "latency") == 0)
+    latencybench(nproc);
+  else if(strcmp(argv[1], "fair") == 0)
+    fairbench(nproc);
+  else if(strcmp(argv[1], "idle") == 0)
+    idlebench(nproc);
+  else if(strcmp(argv[1], "sleep") == 0)
+    sleepbench(nproc);
+  else
+    usage();
+  exit(0);
+}
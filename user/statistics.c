@@ -0,0 +1,94 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// for statlines() and statprint(); as big as the
+// kernel's snapshot (BUFSZ in kernel/stats.c).
+static char statbuf[4096 + NCPU*(256+384) + NPROC*128];
+
+// Read the kernel's statistics device into buf,
+// which holds sz bytes. Returns the number of bytes
+// read, or -1 if the device can't be opened.
+int
+statistics(void *buf, int sz)
+{
+  int fd, i, n;
+
+  fd = open("statistics", O_RDONLY);
+  if(fd < 0){
+    fprintf(2, "stats: open failed\n");
+    return -1;
+  }
+  for(i = 0; i < sz - 1; ){
+    if((n = read(fd, (char*)buf+i, sz-1-i)) <= 0)
+      break;
+    i += n;
+  }
+  ((char*)buf)[i] = 0;
+  close(fd);
+  return i;
+}
+
+// Sum every number that follows key in a statistics snapshot.
+// For example, statsum(buf, "free ") adds up the free page
+// counts of all CPUs. key matches only at the start of a
+// field, so "hit " doesn't match "zhit ".
+uint64
+statsum(char *buf, char *key)
+{
+  uint64 sum = 0;
+  int n = strlen(key);
+  char *p;
+
+  for(p = buf; *p; p++){
+    if(p > buf && p[-1] != ' ' && p[-1] != '\n')
+      continue;
+    if(memcmp(p, key, n) != 0)
+      continue;
+    p += n;
+    sum += atoi(p);
+  }
+  return sum;
+}
+
+// Take a snapshot and sum the number after key on each
+// line that starts with prefix. For example,
+// statlines("swap: ", "pageout ") is the number of
+// pages swapped out. Returns -1 if no line starts with prefix.
+uint64
+statlines(char *prefix, char *key)
+{
+  char *s, *e;
+  uint64 n = 0;
+  int found = 0;
+
+  statistics(statbuf, sizeof(statbuf));
+  for(s = statbuf; (e = strchr(s, '\n')) != 0; s = e + 1){
+    if(memcmp(s, prefix, strlen(prefix)) != 0)
+      continue;
+    *e = 0;
+    n += statsum(s, key);
+    *e = '\n';
+    found = 1;
+  }
+  return found ? n : -1;
+}
+
+// Take a snapshot and print the lines that start with
+// prefix; "" prints them all.
+void
+statprint(char *prefix)
+{
+  char *s, *e;
+
+  statistics(statbuf, sizeof(statbuf));
+  for(s = statbuf; (e = strchr(s, '\n')) != 0; s = e + 1){
+    if(memcmp(s, prefix, strlen(prefix)) != 0)
+      continue;
+    *e = 0;
+    printf("%s\n", s);
+    *e = '\n';
+  }
+}
@@ -0,0 +1,245 @@
+//
+// tests for the kernel's word-at-a-time memset(), memmove(),
+// memcmp() and strncpy(), against byte-at-a-time versions,
+// over every alignment of heads and tails; and a benchmark.
+//
+// the Makefile links in kernel/string.c with its names
+// prefixed by k_.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+void* k_memset(void*, int, uint);
+void* k_memmove(void*, const void*, uint);
+int   k_memcmp(const void*, const void*, uint);
+char* k_strncpy(char*, const char*, int);
+
+#define BUFSZ  (2*PGSIZE)
+#define MAXLEN 80        // lengths 0..MAXLEN cover heads, words, and tails
+#define BIGLEN 1001      // and one long, odd length
+#define BENCHN 5000
+
+char buf[BUFSZ], want[BUFSZ], src[BUFSZ];
+
+void*
+ref_memset(void *dst, int c, uint n)
+{
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = c;
+  return dst;
+}
+
+void*
+ref_memmove(void *dst, const void *src, uint n)
+{
+  const char *s = src;
+  char *d = dst;
+
+  if(s < d && s + n > d){
+    s += n;
+    d += n;
+    while(n-- > 0)
+      *--d = *--s;
+  } else {
+    while(n-- > 0)
+      *d++ = *s++;
+  }
+  return dst;
+}
+
+int
+ref_memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1 = v1, *s2 = v2;
+
+  for(; n > 0; n--, s1++, s2++)
+    if(*s1 != *s2)
+      return *s1 - *s2;
+  return 0;
+}
+
+char*
+ref_strncpy(char *s, const char *t, int n)
+{
+  char *os = s;
+
+  while(n-- > 0 && (*s++ = *t++) != 0)
+    ;
+  while(n-- > 0)
+    *s++ = 0;
+  return os;
+}
+
+// fill buf and want with the same junk.
+void
+junk(int seed)
+{
+  for(int i = 0; i < BUFSZ; i++)
+    buf[i] = want[i] = (i * 7 + seed) | 1;
+}
+
+void
+check(char *what, int a, int b, int n)
+{
+  for(int i = 0; i < BUFSZ; i++){
+    if(buf[i] != want[i]){
+      printf("%s: wrong byte %d (align %d %d, len %d)\n", what, i, a, b, n);
+      exit(1);
+    }
+  }
+}
+
+int
+len(int i)
+{
+  return i <= MAXLEN ? i : BIGLEN;
+}
+
+void
+memsettest(void)
+{
+  printf("memset: ");
+  for(int a = 0; a < 8; a++){
+    for(int i = 0; i <= MAXLEN + 1; i++){
+      junk(a + i);
+      k_memset(buf + 64 + a, 0xa5, len(i));
+      ref_memset(want + 64 + a, 0xa5, len(i));
+      check("memset", a, 0, len(i));
+    }
+  }
+  printf("ok\n");
+}
+
+void
+memmovetest(void)
+{
+  printf("memmove: ");
+  for(int i = 0; i < BUFSZ; i++)
+    src[i] = i * 13 + 5;
+
+  // separate buffers, every pair of alignments.
+  for(int a = 0; a < 8; a++){
+    for(int b = 0; b < 8; b++){
+      for(int i = 0; i <= MAXLEN + 1; i++){
+        junk(a + b + i);
+        k_memmove(buf + 64 + a, src + b, len(i));
+        ref_memmove(want + 64 + a, src + b, len(i));
+        check("memmove", a, b, len(i));
+      }
+    }
+  }
+
+  // overlapping, in both directions.
+  for(int a = 0; a < 24; a++){
+    for(int b = 0; b < 24; b++){
+      for(int i = 0; i <= MAXLEN + 1; i++){
+        junk(a * b + i);
+        k_memmove(buf + 64 + a, buf + 64 + b, len(i));
+        ref_memmove(want + 64 + a, want + 64 + b, len(i));
+        check("memmove overlap", a, b, len(i));
+      }
+    }
+  }
+  printf("ok\n");
+}
+
+int
+sign(int x)
+{
+  return x < 0 ? -1 : x > 0;
+}
+
+void
+memcmptest(void)
+{
+  printf("memcmp: ");
+  for(int a = 0; a < 8; a++){
+    for(int b = 0; b < 8; b++){
+      for(int n = 0; n <= MAXLEN; n++){
+        char *p = buf + a, *q = src + b;
+        for(int i = 0; i < n; i++)
+          p[i] = q[i] = i * 3 + 1;
+        if(k_memcmp(p, q, n) != 0){
+          printf("memcmp: equal buffers differ (align %d %d, len %d)\n", a, b, n);
+          exit(1);
+        }
+        // a difference at each position, either way.
+        for(int i = 0; i < n; i++){
+          for(int d = -1; d <= 1; d += 2){
+            p[i] += d;
+            if(sign(k_memcmp(p, q, n)) != sign(ref_memcmp(p, q, n))){
+              printf("memcmp: wrong sign (align %d %d, len %d, at %d)\n", a, b, n, i);
+              exit(1);
+            }
+            p[i] -= d;
+          }
+        }
+      }
+    }
+  }
+  printf("ok\n");
+}
+
+void
+strncpytest(void)
+{
+  printf("strncpy: ");
+  for(int a = 0; a < 8; a++){
+    for(int b = 0; b < 8; b++){
+      for(int l = 0; l <= 40; l++){
+        char *t = src + 64 + b;
+        for(int i = 0; i < l; i++)
+          t[i] = 'a' + i % 26;
+        t[l] = 0;
+        t[l + 1] = 'x';  // must not be copied
+        for(int n = 0; n <= 48; n++){
+          junk(a + b + l + n);
+          k_strncpy(buf + 64 + a, t, n);
+          ref_strncpy(want + 64 + a, t, n);
+          check("strncpy", a, b, n);
+        }
+      }
+    }
+  }
+  printf("ok\n");
+}
+
+// cycles per call of f on page-sized, aligned buffers,
+// averaged over BENCHN calls.
+int
+bench(int set, void *f)
+{
+  uint64 c0 = r_cycle();
+
+  for(int i = 0; i < BENCHN; i++){
+    if(set)
+      ((void* (*)(void*, int, uint))f)(buf, i, PGSIZE);
+    else
+      ((void* (*)(void*, const void*, uint))f)(buf, src, PGSIZE);
+  }
+  return (r_cycle() - c0) / BENCHN;
+}
+
+void
+benchmark(void)
+{
+  printf("bench: %d page-sized calls, cycles per call\n", BENCHN);
+  printf("bench: memset  bytes %d words %d\n", bench(1, ref_memset), bench(1, k_memset));
+  printf("bench: memmove bytes %d words %d\n", bench(0, ref_memmove), bench(0, k_memmove));
+}
+
+int
+main(int argc, char *argv[])
+{
+  memsettest();
+  memmovetest();
+  memcmptest();
+  strncpytest();
+  benchmark();
+  printf("ALL STRING TESTS PASSED\n");
+  exit(0);
+}
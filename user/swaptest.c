@@ -0,0 +1,167 @@
+//
+// tests for swapping: use more memory than the machine
+// has, and check that every page comes back intact.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+uint64
+freepages(void)
+{
+  return statlines("kmem ", "free ") + statlines("buddy: ", "free ");
+}
+
+uint64
+swapstat(char *key)
+{
+  return statlines("swap: ", key);
+}
+
+// what page i of a region holds; the pid tells the
+// parent's pages from a child's.
+uint64
+pattern(uint64 i, int pid)
+{
+  return (i * 2654435761UL) ^ ((uint64)pid << 40);
+}
+
+void
+fill(char *p, uint64 npages, int pid)
+{
+  for(uint64 i = 0; i < npages; i++){
+    uint64 *w = (uint64*)(p + i*PGSIZE);
+    w[0] = pattern(i, pid);
+    w[PGSIZE/sizeof(uint64) - 1] = ~pattern(i, pid);
+  }
+}
+
+void
+verify(char *s, char *p, uint64 npages, int pid)
+{
+  for(uint64 i = 0; i < npages; i++){
+    uint64 *w = (uint64*)(p + i*PGSIZE);
+    if(w[0] != pattern(i, pid) || w[PGSIZE/sizeof(uint64) - 1] != ~pattern(i, pid)){
+      printf("%s: page %d has the wrong contents\n", s, (int)i);
+      exit(1);
+    }
+  }
+}
+
+// how many pages to allocate: more than are free, by
+// some of the swap area, but not so many that it fills.
+uint64
+bigsize(void)
+{
+  uint64 slots = swapstat("slots ") - swapstat("used ");
+
+  return freepages() + slots / 4;
+}
+
+char*
+grow(char *s, uint64 npages)
+{
+  char *p = sbrk(npages * PGSIZE);
+
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d pages) failed\n", s, (int)npages);
+    exit(1);
+  }
+  return p;
+}
+
+// fill more memory than there is, and read it all back.
+void
+bigtest(char *s)
+{
+  uint64 n = bigsize();
+  uint64 out0 = swapstat("pageout "), in0 = swapstat("pagein ");
+  char *p;
+
+  printf("%s: ", s);
+  p = grow(s, n);
+  fill(p, n, getpid());
+  verify(s, p, n, getpid());
+  if(swapstat("pageout ") == out0 || swapstat("pagein ") == in0){
+    printf("%s: nothing was swapped\n", s);
+    exit(1);
+  }
+  sbrk(-n * PGSIZE);
+  printf("ok\n");
+}
+
+// a child shares its parent's swapped-out pages, and
+// each must see its own writes and only those.
+void
+forktest(char *s)
+{
+  uint64 n = bigsize() * 3 / 4;
+  int pid, parent = getpid(), xstatus;
+  char *p;
+
+  printf("%s: ", s);
+  p = grow(s, n);
+  fill(p, n, parent);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    verify(s, p, n, parent);
+    fill(p, n / 2, getpid());
+    verify(s, p, n / 2, getpid());
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  verify(s, p, n, parent);
+  sbrk(-n * PGSIZE);
+  printf("ok\n");
+}
+
+// exiting frees the slots of swapped-out memory. other
+// processes' pages may be swapped out meanwhile, but a
+// leak would be thousands of slots.
+void
+freetest(char *s)
+{
+  uint64 used0 = swapstat("used ");
+  int pid, xstatus;
+
+  printf("%s: ", s);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    uint64 n = bigsize();
+    fill(grow(s, n), n, getpid());
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(swapstat("used ") > used0 + 64){
+    printf("%s: %d slots leaked\n", s, (int)(swapstat("used ") - used0));
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(swapstat("slots ") == 0){
+    printf("swaptest: no swap area\n");
+    exit(1);
+  }
+  bigtest("big");
+  forktest("fork");
+  freetest("free");
+  printf("ALL SWAP TESTS PASSED\n");
+  exit(0);
+}
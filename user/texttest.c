@@ -0,0 +1,115 @@
+//
+// tests for the shared program text cache.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char buf[512];
+
+// a counter from the "textcache:" line of the statistics
+// device.
+uint64
+textstat(char *key)
+{
+  return statlines("textcache:", key);
+}
+
+// run prog with output discarded; return its exit status.
+int
+run(char *prog)
+{
+  char *argv[] = { prog, "x", 0 };
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("texttest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    exec(prog, argv);
+    exit(-1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+// a second run of the same program should find its text
+// pages cached.
+void
+hittest(void)
+{
+  uint64 hit0;
+
+  printf("hit: ");
+  run("echo");
+  hit0 = textstat("hit ");
+  if(run("echo") != 0){
+    printf("echo failed\n");
+    exit(1);
+  }
+  if(textstat("hit ") <= hit0){
+    printf("no cache hits\n");
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+// copy file src to dst.
+void
+copy(char *src, char *dst)
+{
+  int fd0, fd1, n;
+
+  if((fd0 = open(src, O_RDONLY)) < 0 || (fd1 = open(dst, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("texttest: cannot copy %s\n", src);
+    exit(1);
+  }
+  while((n = read(fd0, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      printf("texttest: write %s failed\n", dst);
+      exit(1);
+    }
+  }
+  close(fd0);
+  close(fd1);
+}
+
+// writing a program must drop its cached pages, and
+// running the rewritten program must still work.
+void
+invaltest(void)
+{
+  uint64 inval0;
+
+  printf("inval: ");
+  copy("echo", "echo.tmp");
+  if(run("echo.tmp") != 0){
+    printf("echo.tmp failed\n");
+    exit(1);
+  }
+  inval0 = textstat("inval ");
+  copy("echo", "echo.tmp");
+  if(textstat("inval ") <= inval0){
+    printf("rewrite did not invalidate\n");
+    exit(1);
+  }
+  if(run("echo.tmp") != 0){
+    printf("rewritten echo.tmp failed\n");
+    exit(1);
+  }
+  unlink("echo.tmp");
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  hittest();
+  invaltest();
+  printf("ALL TEXT CACHE TESTS PASSED\n");
+  exit(0);
+}
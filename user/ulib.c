@@ -145,3 +145,14 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// microseconds since boot, for timing things.
+uint64
+usecs(void)
+{
+  uint64 ns;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ns) < 0)
+    return 0;
+  return ns / 1000;
+}
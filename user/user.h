@@ -22,6 +22,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int clock_gettime(int, uint64*);
+int nice(int);
+int setweight(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +44,10 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 usecs(void);
+
+// statistics.c
+int statistics(void*, int);
+uint64 statsum(char*, char*);
+uint64 statlines(char*, char*);
+void statprint(char*);
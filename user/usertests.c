@@ -2571,6 +2571,40 @@ badarg(char *s)
   exit(0);
 }
 
+// the monotonic clock only goes forward, and at about the
+// rate of the timer ticks; other clocks and bad addresses
+// are errors.
+void
+clocktest(char *s)
+{
+  uint64 t0, t1;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0){
+    printf("%s: clock_gettime failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 1000; i++){
+    if(clock_gettime(CLOCK_MONOTONIC, &t1) < 0 || t1 < t0){
+      printf("%s: clock went backwards\n", s);
+      exit(1);
+    }
+    t0 = t1;
+  }
+  sleep(2);
+  if(clock_gettime(CLOCK_MONOTONIC, &t1) < 0 || t1 - t0 < 1000000){
+    printf("%s: clock did not advance across sleep\n", s);
+    exit(1);
+  }
+  if(clock_gettime(0, &t0) != -1 || clock_gettime(CLOCK_MONOTONIC + 1, &t0) != -1){
+    printf("%s: clock_gettime accepted a bad clock\n", s);
+    exit(1);
+  }
+  if(clock_gettime(CLOCK_MONOTONIC, (uint64*)0xffffffffffL) != -1){
+    printf("%s: clock_gettime wrote to a bad address\n", s);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2635,6 +2669,7 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {clocktest, "clocktest" },
 
   { 0, 0},
 };
@@ -0,0 +1,208 @@
+//
+// virtual memory microbenchmarks.
+//
+// usage: vmbench tlb|pingpong|syscall
+//
+// tlb: read() a cached file into pages spread over a large
+// buffer, so that the kernel's copyout() touches a new
+// physical page on almost every call. The kernel reaches
+// those pages through its direct map, so the result
+// depends on how many TLB entries that map needs.
+//
+// pingpong: pairs of processes, on as many harts as are
+// free, bounce a byte back and forth over pipes, touching
+// a few pages of their own memory between system calls.
+// Every round trip enters the kernel and switches
+// processes, so the result depends on whether the TLB
+// entries for those pages survive (with ASIDs) or are
+// flushed every time.
+//
+// syscall: read() and write() a pipe with large buffers,
+// so that the time goes to copying between user and
+// kernel memory, and report how the kernel did the copies.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define TLBBUF   (16*1024*1024)  // bytes of destination buffer
+#define TLBFILE  (8*1024)        // bytes of source file, stays cached
+#define TLBREADS 20000
+
+#define NPAIR    2               // pingpong process pairs
+#define PINGS    5000            // round trips per pair
+#define WSET     32              // pages touched per round trip
+
+#define SYSBUF   (64*1024)       // bytes per read() and write()
+#define SYSCALLS 2000            // of each
+
+void
+tlb(void)
+{
+  char *buf;
+  int fd;
+  uint64 off, t0, t1;
+
+  fd = open("vmbench.tmp", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("vmbench: cannot create vmbench.tmp\n");
+    exit(1);
+  }
+  buf = sbrk(TLBBUF);
+  if(buf == (char*)-1){
+    printf("vmbench: sbrk failed\n");
+    exit(1);
+  }
+  memset(buf, 'x', TLBBUF);
+  if(write(fd, buf, TLBFILE) != TLBFILE){
+    printf("vmbench: write failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  off = 0;
+  t0 = usecs();
+  for(int i = 0; i < TLBREADS; i++){
+    if((fd = open("vmbench.tmp", O_RDONLY)) < 0){
+      printf("vmbench: open failed\n");
+      exit(1);
+    }
+    // each read starts a page past where the last one ended.
+    if(read(fd, buf + off, TLBFILE) != TLBFILE){
+      printf("vmbench: read failed\n");
+      exit(1);
+    }
+    close(fd);
+    off = (off + TLBFILE + PGSIZE) % (TLBBUF - TLBFILE);
+  }
+  t1 = usecs();
+
+  printf("tlb: %d reads of %d bytes over %d MiB in %dus\n",
+         TLBREADS, TLBFILE, TLBBUF / (1024*1024), (int)(t1 - t0));
+  statprint("kvm:");
+  unlink("vmbench.tmp");
+  sbrk(-TLBBUF);
+}
+
+// one side of a ping-pong pair: PINGS times, touch the
+// working set, then send a byte on out and wait for one
+// on in; or, if not first, the other way around.
+void
+pinger(int in, int out, int first)
+{
+  char *ws, c = 0;
+
+  ws = sbrk(WSET*PGSIZE);
+  if(ws == (char*)-1){
+    printf("vmbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < PINGS; i++){
+    for(int j = 0; j < WSET; j++)
+      ws[j*PGSIZE] += c;
+    if((first && write(out, &c, 1) != 1) || read(in, &c, 1) != 1 ||
+       (!first && write(out, &c, 1) != 1)){
+      printf("vmbench: pingpong pipe failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+void
+pingpong(void)
+{
+  int ab[2], ba[2];
+  uint64 t0, t1;
+
+  t0 = usecs();
+  for(int i = 0; i < NPAIR; i++){
+    if(pipe(ab) < 0 || pipe(ba) < 0){
+      printf("vmbench: pipe failed\n");
+      exit(1);
+    }
+    if(fork() == 0)
+      pinger(ba[0], ab[1], 1);
+    if(fork() == 0)
+      pinger(ab[0], ba[1], 0);
+    close(ab[0]);
+    close(ab[1]);
+    close(ba[0]);
+    close(ba[1]);
+  }
+  for(int i = 0; i < 2*NPAIR; i++)
+    wait(0);
+  t1 = usecs();
+
+  printf("pingpong: %d pairs, %d round trips each, in %dus\n",
+         NPAIR, PINGS, (int)(t1 - t0));
+  statprint("asid:");
+}
+
+void
+syscall(void)
+{
+  char *buf;
+  int fds[2], pid, n;
+  uint64 t0, t1;
+
+  buf = sbrk(SYSBUF);
+  if(buf == (char*)-1){
+    printf("vmbench: sbrk failed\n");
+    exit(1);
+  }
+  memset(buf, 'x', SYSBUF);
+  if(pipe(fds) < 0){
+    printf("vmbench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = usecs();
+  pid = fork();
+  if(pid < 0){
+    printf("vmbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int i = 0; i < SYSCALLS; i++){
+      if(write(fds[1], buf, SYSBUF) != SYSBUF){
+        printf("vmbench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(uint64 left = (uint64)SYSCALLS * SYSBUF; left > 0; left -= n){
+    if((n = read(fds[0], buf, SYSBUF)) <= 0){
+      printf("vmbench: read failed\n");
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  wait(0);
+  t1 = usecs();
+
+  printf("syscall: %d MiB through a pipe in %dus\n",
+         (int)((uint64)SYSCALLS * SYSBUF / (1024*1024)), (int)(t1 - t0));
+  statprint("copy:");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 2 && strcmp(argv[1], "tlb") == 0){
+    tlb();
+  } else if(argc == 2 && strcmp(argv[1], "pingpong") == 0){
+    pingpong();
+  } else if(argc == 2 && strcmp(argv[1], "syscall") == 0){
+    syscall();
+  } else {
+    printf("usage: vmbench tlb|pingpong|syscall\n");
+    exit(1);
+  }
+  exit(0);
+}